@@ -5,6 +5,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <mutex>
+
 #import <React/RCTModuleData.h>
 #import <cxxreact/NativeModule.h>
 
@@ -20,10 +22,19 @@ class RCTNativeModule : public NativeModule {
   json11::Json getConstants() override;
   void invoke(std::string methodName, json11::Json &&params, int callId) override;
   MethodCallResult callSerializableNativeHook(std::string methodName, json11::Json &&params) override;
+  void invoke(unsigned int methodId, json11::Json &&params, int callId) override;
+  MethodCallResult callSerializableNativeHook(unsigned int methodId, json11::Json &&params) override;
+  void invokeBatch(MethodCall *begin, MethodCall *end) override;
 
  private:
+  NSArray<id<RCTBridgeMethod>> *methods();
+  id<RCTBridgeMethod> methodForId(unsigned int methodId);
+
   __weak RCTBridge *m_bridge;
   RCTModuleData *m_moduleData;
+  // The module's methods in order of method ID; fixed the first time it is needed.
+  std::once_flag m_methodsOnce;
+  NSArray<id<RCTBridgeMethod>> *m_methods;
 };
 
 }
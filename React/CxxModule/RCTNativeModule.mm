@@ -20,7 +20,8 @@
 namespace facebook {
 namespace react {
 
-static MethodCallResult invokeInner(RCTBridge *bridge, RCTModuleData *moduleData, std::string methodName, const json11::Json &params);
+static id<RCTBridgeMethod> methodForName(RCTModuleData *moduleData, const std::string &methodName);
+static MethodCallResult invokeInner(RCTBridge *bridge, RCTModuleData *moduleData, id<RCTBridgeMethod> method, const json11::Json &params);
 
 RCTNativeModule::RCTNativeModule(RCTBridge *bridge, RCTModuleData *moduleData)
     : m_bridge(bridge)
@@ -33,7 +34,7 @@ std::string RCTNativeModule::getName() {
 std::vector<MethodDescriptor> RCTNativeModule::getMethods() {
   std::vector<MethodDescriptor> descs;
 
-  for (id<RCTBridgeMethod> method in m_moduleData.methodsByName.allValues) {
+  for (id<RCTBridgeMethod> method in methods()) {
     descs.emplace_back(
       method.JSMethodName,
       RCTFunctionDescriptorFromType(method.functionType)
@@ -50,25 +51,63 @@ json11::Json RCTNativeModule::getConstants() {
 
 
 void RCTNativeModule::invoke(std::string methodName, json11::Json &&params, int callId) {
-   invokeInner(m_bridge, m_moduleData, methodName, std::move(params));
+   invokeInner(m_bridge, m_moduleData, methodForName(m_moduleData, methodName), std::move(params));
 }
 
 MethodCallResult RCTNativeModule::callSerializableNativeHook(std::string methodName, json11::Json &&params) {
-  return invokeInner(m_bridge, m_moduleData, methodName, params);
+  return invokeInner(m_bridge, m_moduleData, methodForName(m_moduleData, methodName), params);
 }
 
-static MethodCallResult invokeInner(RCTBridge *bridge, RCTModuleData *moduleData, std::string methodName, const json11::Json &params) {
-  if (!bridge || !bridge.valid || !moduleData) {
-    return nullptr;
+void RCTNativeModule::invoke(unsigned int methodId, json11::Json &&params, int callId) {
+  invokeInner(m_bridge, m_moduleData, methodForId(methodId), std::move(params));
+}
+
+MethodCallResult RCTNativeModule::callSerializableNativeHook(unsigned int methodId, json11::Json &&params) {
+  return invokeInner(m_bridge, m_moduleData, methodForId(methodId), params);
+}
+
+void RCTNativeModule::invokeBatch(MethodCall *begin, MethodCall *end) {
+  // One pool for the whole batch, rather than leaving each call's converted arguments to
+  // whatever pool the caller drains.
+  @autoreleasepool {
+    for (MethodCall *call = begin; call != end; ++call) {
+      invokeInner(m_bridge, m_moduleData, methodForId(call->methodId), call->arguments);
+    }
   }
+}
+
+NSArray<id<RCTBridgeMethod>> *RCTNativeModule::methods() {
+  // Method IDs index this array, so it must not change once handed out.
+  std::call_once(m_methodsOnce, [this] {
+    m_methods = m_moduleData.methodsByName.allValues;
+  });
+  return m_methods;
+}
 
+id<RCTBridgeMethod> RCTNativeModule::methodForId(unsigned int methodId) {
+  NSArray<id<RCTBridgeMethod>> *methodList = methods();
+  if (methodId >= methodList.count) {
+    RCTLogError(@"Unknown methodID: %u for module: %@", methodId, m_moduleData.name);
+    return nil;
+  }
+  return methodList[methodId];
+}
+
+static id<RCTBridgeMethod> methodForName(RCTModuleData *moduleData, const std::string &methodName) {
   NSString *toFindMethodName = [NSString stringWithCString:methodName.c_str() encoding:NSUTF8StringEncoding];
   id<RCTBridgeMethod> method = moduleData.methodsByName[toFindMethodName];
   if (RCT_DEBUG && !method) {
     RCTLogError(@"Unknown methodID: %@ for module: %@",
                 toFindMethodName, moduleData.name);
   }
- 
+  return method;
+}
+
+static MethodCallResult invokeInner(RCTBridge *bridge, RCTModuleData *moduleData, id<RCTBridgeMethod> method, const json11::Json &params) {
+  if (!bridge || !bridge.valid || !moduleData || !method) {
+    return nullptr;
+  }
+
   NSArray *objcParams = convertCxxJsonToId(params);
   @try {
     id result = [method invokeWithBridge:bridge module:moduleData.instance arguments:objcParams];
@@ -5,129 +5,475 @@
 
 #include "ModuleRegistry.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <stdexcept>
 
 namespace facebook {
 namespace react {
 
 namespace {
 
-std::string normalizeName(std::string name) {
+// Drop the prefix from [name, name + size), in place.
+void normalizeName(const char *&name, size_t &size) {
   // TODO mhorowitz #10487027: This is super ugly.  We should just
   // change iOS to emit normalized names, drop the "RK..." from
   // names hardcoded in Android, and then delete this and the
   // similar hacks in js.
-  if (name.compare(0, 3, "RCT") == 0) {
-    return name.substr(3);
-  } else if (name.compare(0, 2, "RK") == 0) {
-    return name.substr(2);
+  if (size >= 3 && memcmp(name, "RCT", 3) == 0) {
+    name += 3;
+    size -= 3;
+  } else if (size >= 2 && memcmp(name, "RK", 2) == 0) {
+    name += 2;
+    size -= 2;
   }
-  return name;
+}
+
+std::string normalizeName(const std::string& name) {
+  const char *data = name.data();
+  size_t size = name.size();
+  normalizeName(data, size);
+  return std::string(data, size);
+}
+
+std::shared_ptr<const ModuleConfig> buildConfig(NativeModule& module, std::string name) {
+  json11::Json constants = module.getConstants();
+
+  json11::Json::array methodNames;
+  json11::Json::array promiseMethodIds;
+  json11::Json::array syncMethodIds;
+  for (auto& descriptor : module.getMethods()) {
+    // TODO: #10487027 compare tags instead of doing string comparison?
+    const int methodId = static_cast<int>(methodNames.size());
+    if (descriptor.type == "promise") {
+      promiseMethodIds.push_back(methodId);
+    } else if (descriptor.type == "sync") {
+      syncMethodIds.push_back(methodId);
+    }
+    methodNames.push_back(std::move(descriptor.name));
+  }
+
+  const bool noConstants = constants.is_null() ||
+    (constants.is_object() && constants.object_items().empty());
+  if (noConstants && methodNames.empty()) {
+    return nullptr;
+  }
+
+  // string name, object constants, array methodNames (methodId is index), [array promiseMethodIds], [array syncMethodIds]
+  json11::Json::array config;
+  config.push_back(name);
+  config.push_back(std::move(constants));
+  if (!methodNames.empty()) {
+    config.push_back(std::move(methodNames));
+    if (!promiseMethodIds.empty() || !syncMethodIds.empty()) {
+      config.push_back(std::move(promiseMethodIds));
+      if (!syncMethodIds.empty()) {
+        config.push_back(std::move(syncMethodIds));
+      }
+    }
+  }
+
+  auto result = std::make_shared<ModuleConfig>();
+  result->name = std::move(name);
+  result->config = json11::Json(std::move(config));
+  // Configs are handed to any thread that asks for one.
+  result->config.share();
+  result->json = result->config.dump();
+  return result;
+}
+
+uint64_t load(const char *p, size_t size) {
+  uint64_t word = 0;
+  memcpy(&word, p, size);
+  return word;
+}
+
+uint64_t hashName(const char *name, size_t size) {
+  // Eight bytes at a time; mix() spreads the result before it is used. The last, partial word
+  // is read with loads that overlap the bytes before it, rather than copied byte by byte.
+  uint64_t hash = size * 0x9e3779b97f4a7c15ull;
+  uint64_t last;
+  if (size >= 8) {
+    const char *end = name + size;
+    for (; size > 8; name += 8, size -= 8) {
+      hash = (hash ^ load(name, 8)) * 0xff51afd7ed558ccdull;
+      hash ^= hash >> 32;
+    }
+    last = load(end - 8, 8);
+  } else if (size >= 4) {
+    last = load(name, 4) << 32 | load(name + size - 4, 4);
+  } else if (size > 0) {
+    last = static_cast<uint8_t>(name[0]) << 16 | static_cast<uint8_t>(name[size / 2]) << 8 |
+      static_cast<uint8_t>(name[size - 1]);
+  } else {
+    last = 0;
+  }
+  hash = (hash ^ last) * 0xff51afd7ed558ccdull;
+  return hash ^ (hash >> 32);
+}
+
+uint64_t mix(uint64_t x) {
+  // The splitmix64 finalizer.
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// A number in [0, n) taken from the high bits of x, without a division.
+size_t reduce(uint64_t x, size_t n) {
+  return static_cast<size_t>(((x >> 32) * static_cast<uint64_t>(n)) >> 32);
+}
+
+// If id is a whole number in [0, limit), store it in index and return true.
+bool toIndex(const json11::Json& id, double limit, unsigned int& index) {
+  const double value = id.number_value();
+  if (!(value >= 0 && value < limit) || !id.is_number()) {
+    return false;
+  }
+  index = static_cast<unsigned int>(value);
+  return index == value;
 }
 
 }
 
   
+void NameTable::add(const char *name, size_t size) {
+  chars_.append(name, size);
+  offsets_.push_back(static_cast<uint32_t>(chars_.size()));
+}
+
+void NameTable::freeze() {
+  // Hash and displace: the names are spread over as many buckets as there are names, and each
+  // bucket gets a pilot under which its names land in slots no other bucket has taken. The
+  // biggest buckets go first, while most slots are free. If some bucket finds no pilot, the
+  // names are spread again under another salt.
+  const size_t count = size();
+  pilots_.assign(count, 0);
+  slots_.assign(count, 0);
+  std::vector<uint64_t> names(count);
+  for (size_t i = 0; i < count; i++) {
+    names[i] = hashName(data(i), size(i));
+  }
+  std::vector<uint64_t> hashes(count);
+
+  for (salt_ = 0;; salt_++) {
+    std::vector<std::vector<uint32_t>> buckets(count);
+    for (uint32_t i = 0; i < count; i++) {
+      hashes[i] = mix(names[i] ^ salt_);
+      buckets[reduce(hashes[i], count)].push_back(i);
+    }
+    std::vector<uint32_t> order(count);
+    for (uint32_t b = 0; b < count; b++) {
+      order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+      return buckets[a].size() > buckets[b].size();
+    });
+
+    std::vector<bool> taken(count, false);
+    std::vector<size_t> placed;
+    bool failed = false;
+    for (uint32_t b : order) {
+      const std::vector<uint32_t>& bucket = buckets[b];
+      if (bucket.empty()) {
+        break;
+      }
+      uint64_t pilot = 0;
+      for (uint32_t seed = 0; seed < (1u << 20); seed++) {
+        pilot = mix(seed);
+        placed.clear();
+        for (uint32_t i : bucket) {
+          const size_t slot = slotFor(hashes[i], pilot);
+          if (taken[slot] || std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+            break;
+          }
+          placed.push_back(slot);
+        }
+        if (placed.size() == bucket.size()) {
+          break;
+        }
+      }
+      if (placed.size() != bucket.size()) {
+        failed = true;
+        break;
+      }
+      pilots_[b] = pilot;
+      for (size_t k = 0; k < bucket.size(); k++) {
+        taken[placed[k]] = true;
+        slots_[placed[k]] = bucket[k];
+      }
+    }
+    if (!failed) {
+      return;
+    }
+  }
+}
+
+size_t NameTable::slotFor(uint64_t hash, uint64_t pilot) const {
+  // The bucket came from the high half of the hash; the slot comes from the low half.
+  return reduce((hash ^ pilot) << 32, slots_.size());
+}
+
+int NameTable::find(const char *name, size_t size) const {
+  if (slots_.empty()) {
+    return -1;
+  }
+  const uint64_t hash = mix(hashName(name, size) ^ salt_);
+  const uint32_t index = slots_[slotFor(hash, pilots_[reduce(hash, pilots_.size())])];
+  if (this->size(index) != size || memcmp(data(index), name, size) != 0) {
+    return -1;
+  }
+  return static_cast<int>(index);
+}
+
 ModuleRegistry::ModuleRegistry(std::unordered_map<std::string, std::unique_ptr<NativeModule>> nameMoudles, ModuleNotFoundCallback callback)
-  : nameMoudles_{std::move(nameMoudles)}, moduleNotFoundCallback_{callback} {}
+  : moduleNotFoundCallback_{callback} {
+  // Number the modules in name order, so their IDs don't depend on how the map was hashed.
+  std::vector<std::pair<std::string, std::unique_ptr<NativeModule>>> modules;
+  modules.reserve(nameMoudles.size());
+  for (auto& m : nameMoudles) {
+    modules.emplace_back(normalizeName(m.first), std::move(m.second));
+  }
+  std::sort(modules.begin(), modules.end(), [](const std::pair<std::string, std::unique_ptr<NativeModule>>& a,
+                                              const std::pair<std::string, std::unique_ptr<NativeModule>>& b) {
+    return a.first < b.first;
+  });
 
-  
+  std::lock_guard<std::mutex> lock(mutex_);
+  snapshots_.emplace_back(new Snapshot());
+  snapshot_.store(snapshots_.back().get(), std::memory_order_release);
+  publish(std::move(modules));
+}
 
 void ModuleRegistry::registerModules(std::vector<std::unique_ptr<NativeModule>> modules) {
-  
+  std::vector<std::pair<std::string, std::unique_ptr<NativeModule>>> named;
+  named.reserve(modules.size());
+  for (auto& module : modules) {
+    named.emplace_back(normalizeName(module->getName()), std::move(module));
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& m : named) {
+    if (unknownModules_.find(m.first) != unknownModules_.end()) {
+      throw std::runtime_error("module " + m.first + " was required without being registered and is now being registered.");
+    }
+  }
+  publish(std::move(named));
+}
+
+void ModuleRegistry::publish(std::vector<std::pair<std::string, std::unique_ptr<NativeModule>>> modules) {
+  const Snapshot& current = snapshot();
+  std::set<std::string> added;
+  for (auto& m : modules) {
+    if (current.names.find(m.first.data(), m.first.size()) >= 0 || !added.insert(m.first).second) {
+      throw std::runtime_error("module " + m.first + " is already registered");
+    }
+  }
+
+  // The old names are copied and the hash is built again over all of them, which only
+  // registering pays for.
+  std::unique_ptr<Snapshot> next(new Snapshot(current));
+  next->modules.reserve(next->modules.size() + modules.size());
+  for (auto& m : modules) {
+    next->names.add(m.first.data(), m.first.size());
+    next->modules.push_back(m.second.get());
+  }
+  next->names.freeze();
+
+  for (auto& m : modules) {
+    modules_.push_back(std::move(m.second));
+  }
+  snapshot_.store(next.get(), std::memory_order_release);
+  snapshots_.push_back(std::move(next));
 }
 
 std::vector<std::string> ModuleRegistry::moduleNames() {
-  std::vector<std::string> names;
-  for (auto& m : nameMoudles_) {
-     std::string name = normalizeName(m.second->getName());
-     names.push_back(std::move(name));
+  const NameTable& names = snapshot().names;
+  std::vector<std::string> result;
+  result.reserve(names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    result.emplace_back(names.data(i), names.size(i));
   }
-  return names;
+  return result;
 }
 
-std::unique_ptr<ModuleConfig> ModuleRegistry::getConfig(const std::string& name) {
-  
-  if (nameMoudles_.empty()) {
+int ModuleRegistry::moduleId(const char *name, size_t size) const {
+  normalizeName(name, size);
+  return snapshot().names.find(name, size);
+}
+
+std::shared_ptr<const ModuleConfig> ModuleRegistry::getConfig(const std::string& name) {
+  const Snapshot *modules = &snapshot();
+  if (modules->modules.empty()) {
     return nullptr;
   }
 
-  auto it = nameMoudles_.find(name);
+  const char *data = name.data();
+  size_t size = name.size();
+  normalizeName(data, size);
+  int moduleId = modules->names.find(data, size);
   
-  if (it == nameMoudles_.end()) {
-    if (unknownModules_.find(name) != unknownModules_.end()) {
-      return nullptr;
+  if (moduleId < 0) {
+    const std::string normalized(data, size);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (unknownModules_.find(normalized) != unknownModules_.end()) {
+        return nullptr;
+      }
+    }
+    // The callback may register the module, so it must run without the lock held.
+    if (moduleNotFoundCallback_ && moduleNotFoundCallback_(name)) {
+      modules = &snapshot();
+      moduleId = modules->names.find(normalized.data(), normalized.size());
     }
-    if (!moduleNotFoundCallback_ ||
-        !moduleNotFoundCallback_(name) ||
-        (it = nameMoudles_.find(name)) == nameMoudles_.end()) {
-      unknownModules_.insert(name);
-      return nullptr;
+    if (moduleId < 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Look again under the lock, so this can't race with registerModules() adding it.
+      modules = &snapshot();
+      moduleId = modules->names.find(normalized.data(), normalized.size());
+      if (moduleId < 0) {
+        unknownModules_.insert(normalized);
+        return nullptr;
+      }
     }
   }
 
-  NativeModule *module = it->second.get();
-  
-  // string name, object constants, array methodNames (methodId is index), [array promiseMethodIds], [array syncMethodIds]
-  json11::Json::array config = json11::Json::array();
-  
-  config.push_back(json11::Json(name));
-  config.push_back(module->getConstants());
- 
-  std::vector<MethodDescriptor> methods = module->getMethods();
- 
-  json11::Json::array methodNames = json11::Json::array();
-  json11::Json::array promiseMethodIds = json11::Json::array();
-  json11::Json::array syncMethodIds = json11::Json::array();
-  
-//
-//  for (auto& descriptor : methods) {
-//    // TODO: #10487027 compare tags instead of doing string comparison?
-//    methodNames.push_back(std::move(descriptor.name));
-//    if (descriptor.type == "promise") {
-//      promiseMethodIds.push_back(methodNames.size() - 1);
-//    } else if (descriptor.type == "sync") {
-//      syncMethodIds.push_back(methodNames.size() - 1);
-//    }
-//  }
-//
-//  if (!methodNames.empty()) {
-//    config.push_back(std::move(methodNames));
-//    if (!promiseMethodIds.empty() || !syncMethodIds.empty()) {
-//      config.push_back(std::move(promiseMethodIds));
-//      if (!syncMethodIds.empty()) {
-//        config.push_back(std::move(syncMethodIds));
-//      }
-//    }
-//  }
-//
-//
-//  if (config.size() == 2 && config[1].empty()) {
-//    // no constants or methods
-//    return nullptr;
-//  } else {
-//    return ModuleConfig{name, config};
-//  }
-  return nullptr;
+  return configById(*modules, moduleId);
 }
-  
-void ModuleRegistry::callNativeMethod(std::string moduleName, std::string methodName, json11::Json&& params, int callId) {
-  auto it = nameMoudles_.find(moduleName);
-  if (it == nameMoudles_.end()) {
-//    throw std::runtime_error(
-//                             folly::to<std::string>("moduleName: ", moduleName, " not existed"));
+
+std::vector<std::shared_ptr<const ModuleConfig>> ModuleRegistry::getConfigs() {
+  const Snapshot& modules = snapshot();
+  std::vector<std::shared_ptr<const ModuleConfig>> configs;
+  configs.reserve(modules.modules.size());
+  for (unsigned int moduleId = 0; moduleId < modules.modules.size(); moduleId++) {
+    configs.push_back(configById(modules, moduleId));
+  }
+  return configs;
+}
+
+void ModuleRegistry::invalidateConfig(unsigned int moduleId) {
+  std::lock_guard<std::mutex> lock(configMutex_);
+  if (moduleId < configs_.size()) {
+    ConfigSlot& slot = configs_[moduleId];
+    slot.built = false;
+    slot.generation++;
+    slot.config.reset();
+  }
+}
+
+void ModuleRegistry::invalidateConfig(const std::string& name) {
+  const int moduleId = this->moduleId(name);
+  if (moduleId >= 0) {
+    invalidateConfig(static_cast<unsigned int>(moduleId));
+  }
+}
+
+std::shared_ptr<const ModuleConfig> ModuleRegistry::configById(const Snapshot& modules, unsigned int moduleId) {
+  unsigned int generation;
+  {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    if (configs_.size() <= moduleId) {
+      configs_.resize(modules.modules.size());
+    }
+    ConfigSlot& slot = configs_[moduleId];
+    if (slot.built) {
+      return slot.config;
+    }
+    generation = slot.generation;
+  }
+
+  // Built without the lock held, since it calls into the module.
+  std::shared_ptr<const ModuleConfig> config = buildConfig(
+    *modules.modules[moduleId], std::string(modules.names.data(moduleId), modules.names.size(moduleId)));
+
+  std::lock_guard<std::mutex> lock(configMutex_);
+  ConfigSlot& slot = configs_[moduleId];
+  if (slot.built) {
+    return slot.config;
+  }
+  if (slot.generation == generation) {
+    slot.built = true;
+    slot.config = config;
+  }
+  return config;
+}
+
+NativeModule *ModuleRegistry::moduleById(unsigned int moduleId) {
+  const Snapshot& modules = snapshot();
+  if (moduleId >= modules.modules.size()) {
+    throw std::runtime_error(
+      "moduleId " + std::to_string(moduleId) + " out of range [0.." + std::to_string(modules.modules.size()) + ")");
+  }
+  return modules.modules[moduleId];
+}
+
+NativeModule *ModuleRegistry::moduleByName(const std::string& name) {
+  const int moduleId = this->moduleId(name);
+  if (moduleId < 0) {
+    throw std::runtime_error("moduleName: " + name + " not existed");
   }
-  NativeModule *module = it->second.get();
-  module->invoke(methodName, std::move(params), callId);
+  // Read after moduleId(), so it holds at least the snapshot the ID came from.
+  return snapshot().modules[moduleId];
 }
 
-MethodCallResult ModuleRegistry::callSerializableNativeHook(std::string moduleName, std::string methodName, json11::Json&& params) {
-  auto it = nameMoudles_.find(moduleName);
-  if (it == nameMoudles_.end()) {
-//    throw std::runtime_error(
-//                             folly::to<std::string>("moduleName", moduleName, " not existed"));
+void ModuleRegistry::callNativeMethod(unsigned int moduleId, unsigned int methodId, json11::Json&& params, int callId) {
+  moduleById(moduleId)->invoke(methodId, std::move(params), callId);
+}
+
+MethodCallResult ModuleRegistry::callSerializableNativeHook(unsigned int moduleId, unsigned int methodId, json11::Json&& params) {
+  return moduleById(moduleId)->callSerializableNativeHook(methodId, std::move(params));
+}
+
+void ModuleRegistry::callNativeMethod(const std::string& moduleName, const std::string& methodName, json11::Json&& params, int callId) {
+  moduleByName(moduleName)->invoke(methodName, std::move(params), callId);
+}
+
+MethodCallResult ModuleRegistry::callSerializableNativeHook(const std::string& moduleName, const std::string& methodName, json11::Json&& params) {
+  return moduleByName(moduleName)->callSerializableNativeHook(methodName, std::move(params));
+}
+
+void ModuleRegistry::callNativeMethods(json11::Json&& calls) {
+  json11::Json::array columns = calls.take_array();
+  if (columns.size() < 3 || !columns[0].is_array() || !columns[1].is_array() || !columns[2].is_array()) {
+    throw std::invalid_argument("Did not get valid calls back from JS: expected [moduleIds, methodIds, params, callId?]");
+  }
+  const json11::Json::array& moduleIds = columns[0].array_items();
+  const json11::Json::array& methodIds = columns[1].array_items();
+  json11::Json::array params = columns[2].take_array();
+  const size_t count = moduleIds.size();
+  if (methodIds.size() != count || params.size() != count) {
+    throw std::invalid_argument("Did not get valid calls back from JS: columns of different lengths");
+  }
+  int callId = (columns.size() > 3 && columns[3].is_number()) ? columns[3].int_value() : -1;
+
+  // Check every ID before running anything. Method IDs are checked against the module's
+  // methods by the module itself, when the call runs.
+  const Snapshot& modules = snapshot();
+  std::vector<MethodCall> batch(count);
+  for (size_t i = 0; i < count; i++) {
+    MethodCall& call = batch[i];
+    if (!toIndex(moduleIds[i], modules.modules.size(), call.moduleId) ||
+        !toIndex(methodIds[i], std::numeric_limits<int>::max(), call.methodId)) {
+      throw std::invalid_argument("Did not get valid calls back from JS: bad moduleId or methodId at " + std::to_string(i));
+    }
+    call.arguments = std::move(params[i]);
+    call.callId = callId;
+    if (callId != -1) {
+      callId++;
+    }
+  }
+
+  // Hand each run of consecutive calls to one module over in one go.
+  for (size_t begin = 0; begin < count;) {
+    size_t end = begin + 1;
+    while (end < count && batch[end].moduleId == batch[begin].moduleId) {
+      end++;
+    }
+    modules.modules[batch[begin].moduleId]->invokeBatch(batch.data() + begin, batch.data() + end);
+    begin = end;
   }
-  NativeModule *module = it->second.get();
-  return module->callSerializableNativeHook(methodName, std::move(params));
 }
 
 }}
@@ -5,7 +5,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
@@ -23,9 +28,44 @@ class NativeModule;
 
 struct ModuleConfig {
   std::string name;
+  // [name, constants, methodNames, [promiseMethodIds], [syncMethodIds]]; a method's ID is its
+  // position in methodNames.
   json11::Json config;
+  // config, serialized.
+  std::string json;
 };
 
+/* NameTable
+ *
+ * A fixed set of names, numbered in the order they were added, stored one after another in a
+ * single string. Once frozen, find() maps a name to its number through a minimal perfect
+ * hash: one pass over the name to hash it, two table reads and one comparison, with no
+ * allocation.
+ */
+class NameTable {
+ public:
+  void add(const char *name, size_t size);
+  // Build the hash over the names added so far. No two of them may be equal.
+  void freeze();
+
+  size_t size() const { return offsets_.size() - 1; }
+  const char *data(size_t index) const { return chars_.data() + offsets_[index]; }
+  size_t size(size_t index) const { return offsets_[index + 1] - offsets_[index]; }
+  // The number of the name, or -1 if it isn't one of them.
+  int find(const char *name, size_t size) const;
+
+ private:
+  size_t slotFor(uint64_t hash, uint64_t pilot) const;
+
+  std::string chars_;
+  // Where each name starts in chars_, and where the last one ends.
+  std::vector<uint32_t> offsets_{0};
+  // Per bucket, the value mixed into its names' hashes to pick their slots.
+  std::vector<uint64_t> pilots_;
+  // The number of the name in each slot.
+  std::vector<uint32_t> slots_;
+  uint64_t salt_ = 0;
+};
 
 class RN_EXPORT ModuleRegistry {
  public:
@@ -37,19 +77,92 @@ class RN_EXPORT ModuleRegistry {
   // notifyCatalystInstanceDestroy: use RAII instead
 
   using ModuleNotFoundCallback = std::function<bool(const std::string &name)>;
-  
+
+  // All methods may be called from any thread. Looking modules up, as every call does, takes
+  // no lock.
   ModuleRegistry(std::unordered_map<std::string, std::unique_ptr<NativeModule>> nameMoudles, ModuleNotFoundCallback callback = nullptr);
+  // Add modules, under their normalized names, with the IDs following the existing ones. Calls
+  // already in flight are unaffected. Throws std::runtime_error, adding none of them, if a
+  // name is taken or was already looked up by getConfig() and found missing.
   void registerModules(std::vector<std::unique_ptr<NativeModule>> modules);
 
+  // Module names, normalized, in order of module ID: a module's ID is its position here.
   std::vector<std::string> moduleNames();
 
-  std::unique_ptr<ModuleConfig> getConfig(const std::string& name);
-
-  void callNativeMethod(std::string moduleName, std::string methodName, json11::Json&& params, int callId);
-  MethodCallResult callSerializableNativeHook(std::string moduleName, std::string methodName, json11::Json&& args);
+  // The ID of the module with this name, normalized or not, or -1 if there is none. Doesn't
+  // allocate.
+  int moduleId(const char *name, size_t size) const;
+  int moduleId(const std::string& name) const { return moduleId(name.data(), name.size()); }
+
+  // The config of the named module, built the first time it is asked for and then kept until
+  // invalidateConfig(). nullptr if there is no such module, or it has no constants and no
+  // methods.
+  std::shared_ptr<const ModuleConfig> getConfig(const std::string& name);
+  // The configs of all modules, indexed by module ID.
+  std::vector<std::shared_ptr<const ModuleConfig>> getConfigs();
+  // Drop a module's config, for when its constants change: the next getConfig() builds it
+  // again.
+  void invalidateConfig(unsigned int moduleId);
+  void invalidateConfig(const std::string& name);
+
+  // A method's ID is its position in its module's getMethods(). Throws std::runtime_error if
+  // there is no module with this ID.
+  void callNativeMethod(unsigned int moduleId, unsigned int methodId, json11::Json&& params, int callId);
+  MethodCallResult callSerializableNativeHook(unsigned int moduleId, unsigned int methodId, json11::Json&& args);
+
+  // Look the module up by name first. Throws std::runtime_error if there is none.
+  void callNativeMethod(const std::string& moduleName, const std::string& methodName, json11::Json&& params, int callId);
+  MethodCallResult callSerializableNativeHook(const std::string& moduleName, const std::string& methodName, json11::Json&& args);
+
+  // Run a batch as flushed by the JS message queue: [moduleIds, methodIds, params, callId?],
+  // the first three arrays of equal length, with callId numbering the calls from the first
+  // one on. Before anything runs, the shape of the batch and every module ID are checked, and
+  // method IDs are checked to be whole numbers; if any of that fails, std::invalid_argument
+  // is thrown. Whether a method ID names one of the module's methods is left to the module,
+  // which only learns its methods when asked. The calls then run in order, each run of
+  // consecutive calls to one module handed to it in a single invokeBatch().
+  void callNativeMethods(json11::Json&& calls);
 
  private:
-  std::unordered_map<std::string, std::unique_ptr<NativeModule>> nameMoudles_;
+  // The registered modules as of some point in time. It is never changed once published:
+  // registerModules() publishes a new one, and keeps the old ones alive until the registry is
+  // destroyed, so readers need neither a lock nor a reference count. Registering is rare, so
+  // this costs little memory.
+  struct Snapshot {
+    // Both indexed by module ID.
+    std::vector<NativeModule*> modules;
+    NameTable names;
+  };
+
+  const Snapshot& snapshot() const {
+    return *snapshot_.load(std::memory_order_acquire);
+  }
+  // Must be called with mutex_ held.
+  void publish(std::vector<std::pair<std::string, std::unique_ptr<NativeModule>>> modules);
+
+  NativeModule *moduleById(unsigned int moduleId);
+  NativeModule *moduleByName(const std::string& name);
+  std::shared_ptr<const ModuleConfig> configById(const Snapshot& modules, unsigned int moduleId);
+
+  struct ConfigSlot {
+    bool built = false;
+    // Bumped by invalidateConfig(), so a config built meanwhile isn't kept.
+    unsigned int generation = 0;
+    std::shared_ptr<const ModuleConfig> config;
+  };
+
+  std::atomic<const Snapshot*> snapshot_;
+
+  // Guards modules_, snapshots_ and unknownModules_, which only writers and lookups of missing
+  // modules touch.
+  std::mutex mutex_;
+  // Owns the modules in every snapshot, in order of module ID.
+  std::vector<std::unique_ptr<NativeModule>> modules_;
+  std::vector<std::unique_ptr<const Snapshot>> snapshots_;
+
+  // Memoized getConfig() results, indexed by module ID.
+  std::mutex configMutex_;
+  std::vector<ConfigSlot> configs_;
 
   // This is populated with modules that are requested via getConfig but are unknown.
   // An error will be thrown if they are subsequently added to the registry.
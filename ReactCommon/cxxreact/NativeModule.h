@@ -8,6 +8,7 @@
 #ifndef NativeModule_H
 #define NativeModule_H
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -28,6 +29,13 @@ struct MethodDescriptor {
 
 using MethodCallResult = std::unique_ptr<json11::Json>;
 
+struct MethodCall {
+  unsigned int moduleId = 0;
+  unsigned int methodId = 0;
+  json11::Json arguments;
+  int callId = -1;
+};
+
 class NativeModule {
  public:
   virtual ~NativeModule() {}
@@ -36,6 +44,15 @@ class NativeModule {
   virtual json11::Json getConstants() = 0;
   virtual void invoke(std::string methodName, json11::Json&& params, int callId) = 0;
   virtual MethodCallResult callSerializableNativeHook(std::string methodName, json11::Json&& args) = 0;
+  // methodId is the method's position in getMethods(), which must not change once called.
+  virtual void invoke(unsigned int methodId, json11::Json&& params, int callId) = 0;
+  virtual MethodCallResult callSerializableNativeHook(unsigned int methodId, json11::Json&& args) = 0;
+  // Run [begin, end), all calls to this module, in order; their arguments may be moved from.
+  virtual void invokeBatch(MethodCall *begin, MethodCall *end) {
+    for (MethodCall *call = begin; call != end; ++call) {
+      invoke(call->methodId, std::move(call->arguments), call->callId);
+    }
+  }
 };
   
 
@@ -0,0 +1,181 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <cxxreact/ModuleRegistry.h>
+
+using namespace facebook::react;
+using json11::Json;
+
+namespace {
+
+class CountingModule : public NativeModule {
+ public:
+  explicit CountingModule(std::string name) : name_(std::move(name)) {}
+
+  std::string getName() override { return name_; }
+  std::vector<MethodDescriptor> getMethods() override { return {MethodDescriptor("call", "async")}; }
+  Json getConstants() override { return Json::object{{"name", name_}}; }
+  void invoke(std::string, Json&&, int) override { calls++; }
+  MethodCallResult callSerializableNativeHook(std::string, Json&&) override { return nullptr; }
+  void invoke(unsigned int, Json&&, int) override { calls++; }
+  MethodCallResult callSerializableNativeHook(unsigned int, Json&&) override { return nullptr; }
+
+  std::atomic<long> calls{0};
+
+ private:
+  const std::string name_;
+};
+
+const unsigned int kBaseModules = 20;
+
+std::unique_ptr<ModuleRegistry> makeRegistry(std::vector<CountingModule*>& modules) {
+  std::unordered_map<std::string, std::unique_ptr<NativeModule>> named;
+  for (unsigned int i = 0; i < kBaseModules; i++) {
+    // Two-digit suffixes, so module IDs, which follow name order, match i.
+    auto module = std::make_unique<CountingModule>("Base" + std::to_string(10 + i));
+    modules.push_back(module.get());
+    named.emplace(module->getName(), std::move(module));
+  }
+  return std::make_unique<ModuleRegistry>(std::move(named));
+}
+
+std::vector<std::unique_ptr<NativeModule>> modulesNamed(const std::string& name) {
+  std::vector<std::unique_ptr<NativeModule>> modules;
+  modules.push_back(std::make_unique<CountingModule>(name));
+  return modules;
+}
+
+}
+
+TEST(ModuleRegistry, RegisterRejectsTakenAndMissingNames) {
+  std::vector<CountingModule*> base;
+  auto registry = makeRegistry(base);
+
+  EXPECT_THROW(registry->registerModules(modulesNamed("Base10")), std::runtime_error);
+  EXPECT_THROW(registry->registerModules(modulesNamed("RCTBase10")), std::runtime_error);
+
+  // Once a name has been looked up and found missing, it can't be registered.
+  EXPECT_EQ(registry->getConfig("Late"), nullptr);
+  EXPECT_THROW(registry->registerModules(modulesNamed("RCTLate")), std::runtime_error);
+
+  registry->registerModules(modulesNamed("RCTOnTime"));
+  ASSERT_NE(registry->getConfig("OnTime"), nullptr);
+  EXPECT_EQ(registry->getConfig("OnTime")->name, "OnTime");
+  EXPECT_EQ(registry->moduleNames().size(), kBaseModules + 1);
+}
+
+// Calls, config lookups and invalidation from several threads while modules are registered.
+TEST(ModuleRegistry, ConcurrentUseDuringRegistration) {
+  std::vector<CountingModule*> base;
+  auto registry = makeRegistry(base);
+
+  const int kRegistrations = 300;
+  const int kReaders = 4;
+  std::atomic<bool> stop{false};
+  std::atomic<long> baseCalls{0};
+  std::atomic<bool> failed{false};
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < kReaders; t++) {
+    readers.emplace_back([&, t] {
+      for (long n = 0; !stop; n++) {
+        const unsigned int id = static_cast<unsigned int>(n % kBaseModules);
+        registry->callNativeMethod(id, 0, Json::array{}, 1);
+        registry->callNativeMethod("Base" + std::to_string(10 + id), "call", Json::array{}, 1);
+        registry->callNativeMethods(Json::array{Json::array{int(id), int(id), 0}, Json::array{0, 0, 0},
+                                                Json::array{Json::array{}, Json::array{}, Json::array{}}});
+        baseCalls += 5;
+
+        // The newest module is usable as soon as its name is visible.
+        const std::vector<std::string> names = registry->moduleNames();
+        const unsigned int newest = static_cast<unsigned int>(names.size() - 1);
+        registry->callNativeMethod(newest, 0, Json::array{}, 1);
+        if (newest < kBaseModules) {
+          baseCalls++;
+        }
+        const std::shared_ptr<const ModuleConfig> config = registry->getConfig(names[newest]);
+        if (!config || config->name != names[newest]) {
+          failed = true;
+        }
+        if (registry->getConfig("Missing" + std::to_string(t)) != nullptr) {
+          failed = true;
+        }
+        if (n % 16 == 0) {
+          registry->invalidateConfig(newest);
+        }
+      }
+    });
+  }
+
+  // Looks up each name while it is being registered. A lookup that finds it missing makes
+  // the registration throw; one that runs after the registration must find it.
+  std::vector<std::atomic<bool>> sawMissing(kRegistrations);
+  for (auto& missing : sawMissing) {
+    missing = false;
+  }
+  std::atomic<int> registering{-1};
+  std::thread prober([&] {
+    while (!stop) {
+      const int k = registering;
+      if (k >= 0 && registry->getConfig("Racy" + std::to_string(k)) == nullptr) {
+        sawMissing[k] = true;
+      }
+    }
+  });
+
+  std::vector<bool> registered(kRegistrations);
+  for (int k = 0; k < kRegistrations; k++) {
+    std::vector<std::unique_ptr<NativeModule>> modules = modulesNamed("RCTAdded" + std::to_string(k));
+    modules.push_back(std::make_unique<CountingModule>("RKExtra" + std::to_string(k)));
+    registry->registerModules(std::move(modules));
+
+    registering = k;
+    std::this_thread::yield();
+    try {
+      registry->registerModules(modulesNamed("Racy" + std::to_string(k)));
+      registered[k] = true;
+    } catch (const std::runtime_error&) {
+      registered[k] = false;
+    }
+    std::this_thread::yield();
+  }
+  stop = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  prober.join();
+
+  EXPECT_FALSE(failed);
+  long calls = 0;
+  for (CountingModule* module : base) {
+    calls += module->calls;
+  }
+  EXPECT_EQ(calls, baseCalls);
+
+  size_t racy = 0;
+  for (int k = 0; k < kRegistrations; k++) {
+    const bool found = registry->getConfig("Racy" + std::to_string(k)) != nullptr;
+    EXPECT_EQ(found, registered[k]) << k;
+    if (registered[k]) {
+      EXPECT_FALSE(sawMissing[k]) << k;
+      racy++;
+    } else {
+      EXPECT_TRUE(sawMissing[k]) << k;
+    }
+  }
+  EXPECT_EQ(registry->moduleNames().size(), kBaseModules + 2 * kRegistrations + racy);
+  EXPECT_EQ(registry->getConfigs().size(), registry->moduleNames().size());
+}
@@ -21,10 +21,31 @@
 
 #include "json11.hpp"
 #include <cassert>
+#include <cfloat>
 #include <cmath>
 #include <cstdlib>
 #include <cstdio>
 #include <limits>
+#include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 namespace json11 {
 
@@ -32,113 +53,883 @@ static const int max_depth = 200;
 
 using std::string;
 using std::vector;
-using std::map;
 using std::make_shared;
 using std::initializer_list;
 using std::move;
 
-/* Helper for representing null - just a do-nothing struct, plus comparison
- * operators so the helpers in JsonValue work. We can't use nullptr_t because
- * it may not be orderable.
+/* * * * * * * * * * * * * * * * * * * *
+ * Number formatting
+ *
+ * Doubles are printed with the Grisu2 algorithm (Florian Loitsch, "Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", PLDI 2010): the output always reads back as
+ * the same double, and is the shortest such string in all but a tiny fraction of cases. The
+ * layout follows printf's %g, so integral values print without a fraction, and values far
+ * from 1 use an exponent. Neither formatter depends on the C locale.
+ */
+
+// Pairs of decimal digits "00" to "99", for emitting two digits at a time.
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* format_uint(value, buf)
+ *
+ * Write the decimal digits of value to buf, which must have room for 20 bytes. Return a
+ * pointer just past the last digit.
+ */
+static char * format_uint(uint64_t value, char *buf) {
+    char tmp[20];
+    char *p = tmp + sizeof tmp;
+    while (value >= 100) {
+        const unsigned pair = static_cast<unsigned>(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        const unsigned pair = static_cast<unsigned>(value) * 2;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    } else {
+        *--p = static_cast<char>('0' + value);
+    }
+    const size_t n = tmp + sizeof tmp - p;
+    memcpy(buf, p, n);
+    return buf + n;
+}
+
+static char * format_int(int value, char *buf) {
+    uint64_t magnitude = static_cast<uint64_t>(value);
+    if (value < 0) {
+        *buf++ = '-';
+        magnitude = 0 - static_cast<uint64_t>(static_cast<int64_t>(value));
+    }
+    return format_uint(magnitude, buf);
+}
+
+namespace {
+
+/* DiyFp
+ *
+ * A "do it yourself" floating-point number f * 2^e, with a 64-bit significand.
+ */
+struct DiyFp final {
+    uint64_t f;
+    int e;
+
+    DiyFp(uint64_t f, int e) : f(f), e(e) {}
+
+    static DiyFp sub(const DiyFp &x, const DiyFp &y) {
+        return DiyFp(x.f - y.f, x.e);
+    }
+
+    // The upper 64 bits of the 128-bit product, rounded.
+    static DiyFp mul(const DiyFp &x, const DiyFp &y) {
+        const uint64_t u_lo = x.f & 0xFFFFFFFFu;
+        const uint64_t u_hi = x.f >> 32;
+        const uint64_t v_lo = y.f & 0xFFFFFFFFu;
+        const uint64_t v_hi = y.f >> 32;
+
+        const uint64_t p0 = u_lo * v_lo;
+        const uint64_t p1 = u_lo * v_hi;
+        const uint64_t p2 = u_hi * v_lo;
+        const uint64_t p3 = u_hi * v_hi;
+
+        uint64_t mid = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+        mid += uint64_t(1) << 31;
+        return DiyFp(p3 + (p2 >> 32) + (p1 >> 32) + (mid >> 32), x.e + y.e + 64);
+    }
+
+    static DiyFp normalize(DiyFp x) {
+        while ((x.f >> 63) == 0) {
+            x.f <<= 1;
+            x.e--;
+        }
+        return x;
+    }
+
+    static DiyFp normalize_to(const DiyFp &x, int e) {
+        return DiyFp(x.f << (x.e - e), e);
+    }
+};
+
+/* Boundaries
+ *
+ * A positive double v, and the midpoints m- and m+ between it and its neighbours: every real
+ * number strictly between them rounds to v.
  */
-struct NullStruct {
-    bool operator==(NullStruct) const { return true; }
-    bool operator<(NullStruct) const { return false; }
+struct Boundaries final {
+    DiyFp w;
+    DiyFp minus;
+    DiyFp plus;
+};
+
+Boundaries compute_boundaries(double value) {
+    const int bias = 1023 + 52;
+    const uint64_t hidden_bit = uint64_t(1) << 52;
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    const uint64_t biased_e = bits >> 52;
+    const uint64_t fraction = bits & (hidden_bit - 1);
+
+    const DiyFp v = biased_e == 0
+        ? DiyFp(fraction, 1 - bias)
+        : DiyFp(fraction + hidden_bit, static_cast<int>(biased_e) - bias);
+
+    // The lower neighbour is closer when v is a power of two (other than the smallest normal).
+    const bool lower_boundary_is_closer = fraction == 0 && biased_e > 1;
+    const DiyFp m_plus = DiyFp(2 * v.f + 1, v.e - 1);
+    const DiyFp m_minus = lower_boundary_is_closer ? DiyFp(4 * v.f - 1, v.e - 2)
+                                                   : DiyFp(2 * v.f - 1, v.e - 1);
+
+    const DiyFp w_plus = DiyFp::normalize(m_plus);
+    return { DiyFp::normalize(v), DiyFp::normalize_to(m_minus, w_plus.e), w_plus };
+}
+
+// Grisu2 scales the value so that its binary exponent lands in [alpha, gamma].
+const int grisu_alpha = -60;
+const int grisu_gamma = -32;
+
+struct CachedPower final {
+    uint64_t f;
+    int e;
+    int k;
 };
 
+/* cached_power_for_binary_exponent(e)
+ *
+ * Return a normalized power of ten c = 10^k such that a normalized DiyFp with exponent e,
+ * multiplied by c, has an exponent in [grisu_alpha, grisu_gamma].
+ */
+CachedPower cached_power_for_binary_exponent(int e) {
+    // 10^k for k = -300, -292, ..., 324, rounded to 64 bits.
+    static const CachedPower cached_powers[] = {
+        { 0xAB70FE17C79AC6CA, -1060, -300 },
+        { 0xFF77B1FCBEBCDC4F, -1034, -292 },
+        { 0xBE5691EF416BD60C, -1007, -284 },
+        { 0x8DD01FAD907FFC3C,  -980, -276 },
+        { 0xD3515C2831559A83,  -954, -268 },
+        { 0x9D71AC8FADA6C9B5,  -927, -260 },
+        { 0xEA9C227723EE8BCB,  -901, -252 },
+        { 0xAECC49914078536D,  -874, -244 },
+        { 0x823C12795DB6CE57,  -847, -236 },
+        { 0xC21094364DFB5637,  -821, -228 },
+        { 0x9096EA6F3848984F,  -794, -220 },
+        { 0xD77485CB25823AC7,  -768, -212 },
+        { 0xA086CFCD97BF97F4,  -741, -204 },
+        { 0xEF340A98172AACE5,  -715, -196 },
+        { 0xB23867FB2A35B28E,  -688, -188 },
+        { 0x84C8D4DFD2C63F3B,  -661, -180 },
+        { 0xC5DD44271AD3CDBA,  -635, -172 },
+        { 0x936B9FCEBB25C996,  -608, -164 },
+        { 0xDBAC6C247D62A584,  -582, -156 },
+        { 0xA3AB66580D5FDAF6,  -555, -148 },
+        { 0xF3E2F893DEC3F126,  -529, -140 },
+        { 0xB5B5ADA8AAFF80B8,  -502, -132 },
+        { 0x87625F056C7C4A8B,  -475, -124 },
+        { 0xC9BCFF6034C13053,  -449, -116 },
+        { 0x964E858C91BA2655,  -422, -108 },
+        { 0xDFF9772470297EBD,  -396, -100 },
+        { 0xA6DFBD9FB8E5B88F,  -369,  -92 },
+        { 0xF8A95FCF88747D94,  -343,  -84 },
+        { 0xB94470938FA89BCF,  -316,  -76 },
+        { 0x8A08F0F8BF0F156B,  -289,  -68 },
+        { 0xCDB02555653131B6,  -263,  -60 },
+        { 0x993FE2C6D07B7FAC,  -236,  -52 },
+        { 0xE45C10C42A2B3B06,  -210,  -44 },
+        { 0xAA242499697392D3,  -183,  -36 },
+        { 0xFD87B5F28300CA0E,  -157,  -28 },
+        { 0xBCE5086492111AEB,  -130,  -20 },
+        { 0x8CBCCC096F5088CC,  -103,  -12 },
+        { 0xD1B71758E219652C,   -77,   -4 },
+        { 0x9C40000000000000,   -50,    4 },
+        { 0xE8D4A51000000000,   -24,   12 },
+        { 0xAD78EBC5AC620000,     3,   20 },
+        { 0x813F3978F8940984,    30,   28 },
+        { 0xC097CE7BC90715B3,    56,   36 },
+        { 0x8F7E32CE7BEA5C70,    83,   44 },
+        { 0xD5D238A4ABE98068,   109,   52 },
+        { 0x9F4F2726179A2245,   136,   60 },
+        { 0xED63A231D4C4FB27,   162,   68 },
+        { 0xB0DE65388CC8ADA8,   189,   76 },
+        { 0x83C7088E1AAB65DB,   216,   84 },
+        { 0xC45D1DF942711D9A,   242,   92 },
+        { 0x924D692CA61BE758,   269,  100 },
+        { 0xDA01EE641A708DEA,   295,  108 },
+        { 0xA26DA3999AEF774A,   322,  116 },
+        { 0xF209787BB47D6B85,   348,  124 },
+        { 0xB454E4A179DD1877,   375,  132 },
+        { 0x865B86925B9BC5C2,   402,  140 },
+        { 0xC83553C5C8965D3D,   428,  148 },
+        { 0x952AB45CFA97A0B3,   455,  156 },
+        { 0xDE469FBD99A05FE3,   481,  164 },
+        { 0xA59BC234DB398C25,   508,  172 },
+        { 0xF6C69A72A3989F5C,   534,  180 },
+        { 0xB7DCBF5354E9BECE,   561,  188 },
+        { 0x88FCF317F22241E2,   588,  196 },
+        { 0xCC20CE9BD35C78A5,   614,  204 },
+        { 0x98165AF37B2153DF,   641,  212 },
+        { 0xE2A0B5DC971F303A,   667,  220 },
+        { 0xA8D9D1535CE3B396,   694,  228 },
+        { 0xFB9B7CD9A4A7443C,   720,  236 },
+        { 0xBB764C4CA7A44410,   747,  244 },
+        { 0x8BAB8EEFB6409C1A,   774,  252 },
+        { 0xD01FEF10A657842C,   800,  260 },
+        { 0x9B10A4E5E9913129,   827,  268 },
+        { 0xE7109BFBA19C0C9D,   853,  276 },
+        { 0xAC2820D9623BF429,   880,  284 },
+        { 0x80444B5E7AA7CF85,   907,  292 },
+        { 0xBF21E44003ACDD2D,   933,  300 },
+        { 0x8E679C2F5E44FF8F,   960,  308 },
+        { 0xD433179D9C8CB841,   986,  316 },
+        { 0x9E19DB92B4E31BA9,  1013,  324 },
+    };
+    const int min_decimal_exponent = -300;
+    const int decimal_exponent_step = 8;
+
+    // k = ceil((alpha - e - 1) * log10(2))
+    const int f = grisu_alpha - e - 1;
+    const int k = (f * 78913) / (1 << 18) + static_cast<int>(f > 0);
+    const int index = (-min_decimal_exponent + k + (decimal_exponent_step - 1)) / decimal_exponent_step;
+    assert(index >= 0 && static_cast<size_t>(index) < sizeof cached_powers / sizeof cached_powers[0]);
+
+    const CachedPower cached = cached_powers[index];
+    assert(grisu_alpha <= cached.e + e + 64 && cached.e + e + 64 <= grisu_gamma);
+    return cached;
+}
+
+/* largest_pow10(n, pow10)
+ *
+ * Return the number of decimal digits of n (n > 0), and set pow10 to 10^(digits - 1).
+ */
+int largest_pow10(uint32_t n, uint32_t &pow10) {
+    static const uint32_t powers[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+    };
+    int digits = 1;
+    while (digits < 10 && n >= powers[digits])
+        digits++;
+    pow10 = powers[digits - 1];
+    return digits;
+}
+
+void grisu2_round(char *buf, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+    // Move the last digit towards the exact value while staying inside the rounding interval.
+    while (rest < dist && delta - rest >= ten_k
+           && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+        buf[len - 1]--;
+        rest += ten_k;
+    }
+}
+
+/* grisu2_digit_gen(buf, len, decimal_exponent, m_minus, w, m_plus)
+ *
+ * Generate the shortest digit string in (m_minus, m_plus), as close to w as possible. The
+ * value is buf[0..len) * 10^decimal_exponent.
+ */
+void grisu2_digit_gen(char *buf, int &len, int &decimal_exponent,
+                      const DiyFp &m_minus, const DiyFp &w, const DiyFp &m_plus) {
+    uint64_t delta = DiyFp::sub(m_plus, m_minus).f;
+    uint64_t dist = DiyFp::sub(m_plus, w).f;
+
+    // Split m_plus into an integral part p1 and a fractional part p2.
+    const DiyFp one(uint64_t(1) << -m_plus.e, m_plus.e);
+    uint32_t p1 = static_cast<uint32_t>(m_plus.f >> -one.e);
+    uint64_t p2 = m_plus.f & (one.f - 1);
+
+    uint32_t pow10;
+    int n = largest_pow10(p1, pow10);
+    while (n > 0) {
+        const uint32_t d = p1 / pow10;
+        p1 %= pow10;
+        buf[len++] = static_cast<char>('0' + d);
+        n--;
+
+        const uint64_t rest = (uint64_t(p1) << -one.e) + p2;
+        if (rest <= delta) {
+            decimal_exponent += n;
+            grisu2_round(buf, len, dist, delta, rest, uint64_t(pow10) << -one.e);
+            return;
+        }
+        pow10 /= 10;
+    }
+
+    int m = 0;
+    while (true) {
+        p2 *= 10;
+        buf[len++] = static_cast<char>('0' + (p2 >> -one.e));
+        p2 &= one.f - 1;
+        m++;
+        delta *= 10;
+        dist *= 10;
+        if (p2 <= delta)
+            break;
+    }
+    decimal_exponent -= m;
+    grisu2_round(buf, len, dist, delta, p2, one.f);
+}
+
+/* grisu2(buf, len, decimal_exponent, value)
+ *
+ * Produce the digits of a finite, positive double, such that value is the double nearest
+ * to buf[0..len) * 10^decimal_exponent. buf must have room for 17 digits.
+ */
+void grisu2(char *buf, int &len, int &decimal_exponent, double value) {
+    const Boundaries b = compute_boundaries(value);
+    const CachedPower cached = cached_power_for_binary_exponent(b.plus.e);
+    const DiyFp c_minus_k(cached.f, cached.e);
+
+    const DiyFp w = DiyFp::mul(b.w, c_minus_k);
+    const DiyFp w_minus = DiyFp::mul(b.minus, c_minus_k);
+    const DiyFp w_plus = DiyFp::mul(b.plus, c_minus_k);
+
+    // Shrink the interval by one unit on each side to absorb the rounding error of mul().
+    const DiyFp m_minus(w_minus.f + 1, w_minus.e);
+    const DiyFp m_plus(w_plus.f - 1, w_plus.e);
+
+    len = 0;
+    decimal_exponent = -cached.k;
+    grisu2_digit_gen(buf, len, decimal_exponent, m_minus, w, m_plus);
+}
+
+}//namespace {
+
+/* format_double(value, buf)
+ *
+ * Write the shortest representation of a finite double that reads back as the same value,
+ * laid out like printf's %.17g. buf must have room for 32 bytes. Return a pointer just past
+ * the last character.
+ */
+static char * format_double(double value, char *buf) {
+    if (std::signbit(value)) {
+        *buf++ = '-';
+        value = -value;
+    }
+    if (value == 0) {
+        *buf++ = '0';
+        return buf;
+    }
+
+    int len;
+    int decimal_exponent;
+    grisu2(buf, len, decimal_exponent, value);
+
+    // The value is 0.buf * 10^point; %g switches to an exponent outside 1e-4 <= |v| < 1e17.
+    const int point = len + decimal_exponent;
+    if (len <= point && point <= 17) {
+        // digits[000]
+        memset(buf + len, '0', point - len);
+        return buf + point;
+    }
+    if (0 < point && point <= 17) {
+        // dig.its
+        memmove(buf + point + 1, buf + point, len - point);
+        buf[point] = '.';
+        return buf + len + 1;
+    }
+    if (-4 < point && point <= 0) {
+        // 0.[000]digits
+        memmove(buf + 2 - point, buf, len);
+        buf[0] = '0';
+        buf[1] = '.';
+        memset(buf + 2, '0', -point);
+        return buf + 2 - point + len;
+    }
+
+    // d[.igits]e+dd
+    if (len > 1) {
+        memmove(buf + 2, buf + 1, len - 1);
+        buf[1] = '.';
+        buf += len + 1;
+    } else {
+        buf += 1;
+    }
+    *buf++ = 'e';
+    int exponent = point - 1;
+    if (exponent < 0) {
+        *buf++ = '-';
+        exponent = -exponent;
+    } else {
+        *buf++ = '+';
+    }
+    if (exponent < 10)
+        *buf++ = '0';
+    return format_uint(static_cast<uint64_t>(exponent), buf);
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Block scanning
+ *
+ * The parser spends most of its time inside string bodies and runs of whitespace, and the
+ * serializer inside string bodies. These helpers classify the input 16 bytes at a time (SSE2
+ * or NEON where available, 8-byte SWAR words otherwise) and return the length of the leading
+ * run of "uninteresting" bytes, so that the byte-at-a-time code only runs at the positions
+ * that matter.
+ */
+
+static const uint64_t swar_ones = 0x0101010101010101ULL;
+static const uint64_t swar_highs = 0x8080808080808080ULL;
+
+static inline uint64_t swar_load(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return v;
+}
+
+// Nonzero iff some byte of v is zero.
+static inline uint64_t swar_has_zero(uint64_t v) {
+    return (v - swar_ones) & ~v & swar_highs;
+}
+
+// Nonzero iff some byte of v is equal to c.
+static inline uint64_t swar_has_byte(uint64_t v, uint8_t c) {
+    return swar_has_zero(v ^ (swar_ones * c));
+}
+
+// Nonzero iff some byte of v is less than n (n <= 128).
+static inline uint64_t swar_has_less(uint64_t v, uint8_t n) {
+    return (v - swar_ones * n) & ~v & swar_highs;
+}
+
+static inline bool is_plain_string_byte(char ch) {
+    return ch != '"' && ch != '\\' && static_cast<uint8_t>(ch) >= 0x20;
+}
+
+static inline bool is_whitespace_byte(char ch) {
+    return ch == ' ' || ch == '\r' || ch == '\n' || ch == '\t';
+}
+
+// Whether ch matters when skipping over an array or object: a bracket, a quote, or the start
+// of a comment.
+static inline bool is_structural_byte(char ch) {
+    static const struct Table {
+        bool bytes[256] = {};
+        Table() {
+            for (char c : { '"', '[', ']', '{', '}', '/' })
+                bytes[static_cast<uint8_t>(c)] = true;
+        }
+    } table;
+    return table.bytes[static_cast<uint8_t>(ch)];
+}
+
+/* scan_string_run(p, n)
+ *
+ * Return the number of leading bytes of [p, p + n) that can be copied verbatim into a string
+ * value, i.e. that are not '"', '\\' or a control character.
+ */
+static inline size_t scan_string_run(const char *p, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        const __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        const int mask = _mm_movemask_epi8(special);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t control = vdupq_n_u8(0x1f);
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(p + i));
+        const uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+                                            vcleq_u8(v, control));
+        if (vmaxvq_u8(special))
+            break;
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        const uint64_t v = swar_load(p + i);
+        if (swar_has_byte(v, '"') | swar_has_byte(v, '\\') | swar_has_less(v, 0x20))
+            break;
+    }
+    while (i < n && is_plain_string_byte(p[i]))
+        i++;
+    return i;
+}
+
+/* scan_dump_run(p, n)
+ *
+ * Return the number of leading bytes of [p, p + n) that dump() can copy out unescaped, i.e.
+ * that are not '"', '\\', a control character, or 0xe2 (the lead byte of U+2028 and U+2029).
+ */
+static inline size_t scan_dump_run(const char *p, size_t n) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    const __m128i separator = _mm_set1_epi8(static_cast<char>(0xe2));
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        const __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, control), v), _mm_cmpeq_epi8(v, separator)));
+        const int mask = _mm_movemask_epi8(special);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t control = vdupq_n_u8(0x1f);
+    const uint8x16_t separator = vdupq_n_u8(0xe2);
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(p + i));
+        const uint8x16_t special = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+                                            vorrq_u8(vcleq_u8(v, control), vceqq_u8(v, separator)));
+        if (vmaxvq_u8(special))
+            break;
+    }
+#endif
+    for (; i + 8 <= n; i += 8) {
+        const uint64_t v = swar_load(p + i);
+        if (swar_has_byte(v, '"') | swar_has_byte(v, '\\') | swar_has_less(v, 0x20)
+            | swar_has_byte(v, 0xe2))
+            break;
+    }
+    while (i < n && is_plain_string_byte(p[i]) && static_cast<uint8_t>(p[i]) != 0xe2)
+        i++;
+    return i;
+}
+
+/* scan_whitespace_run(p, n)
+ *
+ * Return the number of leading whitespace bytes in [p, p + n).
+ */
+static inline size_t scan_whitespace_run(const char *p, size_t n) {
+    size_t i = 0;
+    // Most runs are zero or one byte long (compact JSON, or ", " / ": "), so look at a few
+    // bytes before paying for a block load.
+    while (i < n && i < 4) {
+        if (!is_whitespace_byte(p[i]))
+            return i;
+        i++;
+    }
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        const __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))));
+        const int mask = ~_mm_movemask_epi8(ws) & 0xffff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(p + i));
+        const uint8x16_t ws = vorrq_u8(
+            vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\n'))),
+            vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')), vceqq_u8(v, vdupq_n_u8('\t'))));
+        if (vminvq_u8(ws) == 0)
+            break;
+    }
+#endif
+    while (i < n && is_whitespace_byte(p[i]))
+        i++;
+    return i;
+}
+
 /* * * * * * * * * * * * * * * * * * * *
  * Serialization
  */
 
-static void dump(NullStruct, string &out) {
-    out += "null";
+template <size_t N>
+static inline void write(JsonWriter &out, const char (&literal)[N]) {
+    out.write(literal, N - 1);
 }
 
-static void dump(double value, string &out) {
+static void dump(double value, JsonWriter &out) {
     if (std::isfinite(value)) {
         char buf[32];
-        snprintf(buf, sizeof buf, "%.17g", value);
-        out += buf;
+        out.write(buf, format_double(value, buf) - buf);
     } else {
-        out += "null";
+        write(out, "null");
     }
 }
 
-static void dump(int value, string &out) {
-    char buf[32];
-    snprintf(buf, sizeof buf, "%d", value);
-    out += buf;
+static void dump(int value, JsonWriter &out) {
+    char buf[16];
+    out.write(buf, format_int(value, buf) - buf);
 }
 
-static void dump(bool value, string &out) {
-    out += value ? "true" : "false";
+static void dump(bool value, JsonWriter &out) {
+    if (value)
+        write(out, "true");
+    else
+        write(out, "false");
 }
 
-static void dump(const string &value, string &out) {
-    out += '"';
-    for (size_t i = 0; i < value.length(); i++) {
+static void dump(const char *value, size_t length, JsonWriter &out) {
+    static const char hex_digits[] = "0123456789abcdef";
+    out.write('"');
+    size_t i = 0;
+    for (;;) {
+        // Copy everything up to the next byte that needs a closer look in one go.
+        const size_t run = scan_dump_run(value + i, length - i);
+        out.write(value + i, run);
+        i += run;
+        if (i == length)
+            break;
+
         const char ch = value[i];
         if (ch == '\\') {
-            out += "\\\\";
+            write(out, "\\\\");
         } else if (ch == '"') {
-            out += "\\\"";
+            write(out, "\\\"");
         } else if (ch == '\b') {
-            out += "\\b";
+            write(out, "\\b");
         } else if (ch == '\f') {
-            out += "\\f";
+            write(out, "\\f");
         } else if (ch == '\n') {
-            out += "\\n";
+            write(out, "\\n");
         } else if (ch == '\r') {
-            out += "\\r";
+            write(out, "\\r");
         } else if (ch == '\t') {
-            out += "\\t";
+            write(out, "\\t");
         } else if (static_cast<uint8_t>(ch) <= 0x1f) {
-            char buf[8];
-            snprintf(buf, sizeof buf, "\\u%04x", ch);
-            out += buf;
-        } else if (static_cast<uint8_t>(ch) == 0xe2 && static_cast<uint8_t>(value[i+1]) == 0x80
+            const char buf[6] = { '\\', 'u', '0', '0', hex_digits[ch >> 4], hex_digits[ch & 0xf] };
+            out.write(buf, sizeof buf);
+        } else if (static_cast<uint8_t>(ch) == 0xe2 && i + 2 < length
+                   && static_cast<uint8_t>(value[i+1]) == 0x80
                    && static_cast<uint8_t>(value[i+2]) == 0xa8) {
-            out += "\\u2028";
+            write(out, "\\u2028");
             i += 2;
-        } else if (static_cast<uint8_t>(ch) == 0xe2 && static_cast<uint8_t>(value[i+1]) == 0x80
+        } else if (static_cast<uint8_t>(ch) == 0xe2 && i + 2 < length
+                   && static_cast<uint8_t>(value[i+1]) == 0x80
                    && static_cast<uint8_t>(value[i+2]) == 0xa9) {
-            out += "\\u2029";
+            write(out, "\\u2029");
             i += 2;
         } else {
-            out += ch;
+            out.write(ch);
         }
+        i++;
     }
-    out += '"';
+    out.write('"');
+}
+
+static void dump(const string &value, JsonWriter &out) {
+    dump(value.data(), value.size(), out);
 }
 
-static void dump(const Json::array &values, string &out) {
+static void dump(const Json::array &values, JsonWriter &out) {
     bool first = true;
-    out += "[";
+    out.write('[');
     for (const auto &value : values) {
         if (!first)
-            out += ", ";
+            write(out, ", ");
         value.dump(out);
         first = false;
     }
-    out += "]";
+    out.write(']');
 }
 
-static void dump(const Json::object &values, string &out) {
+static void dump(const Json::object &values, JsonWriter &out) {
     bool first = true;
-    out += "{";
+    out.write('{');
     for (const auto &kv : values) {
         if (!first)
-            out += ", ";
+            write(out, ", ");
         dump(kv.first, out);
-        out += ": ";
+        write(out, ": ");
         kv.second.dump(out);
         first = false;
     }
-    out += "}";
+    out.write('}');
 }
 
+/* CountingWriter
+ *
+ * Counts the bytes written to it, reusing a small scratch window, for Json::dump_size().
+ */
+class CountingWriter final : public JsonWriter {
+public:
+    CountingWriter() { reset(); }
+
+    size_t size() const { return m_count + (m_pos - m_buffer); }
+
+private:
+    bool overflow(size_t) override {
+        m_count += m_pos - m_buffer;
+        reset();
+        return true;
+    }
+
+    void reset() {
+        m_pos = m_buffer;
+        m_end = m_buffer + sizeof m_buffer;
+    }
+
+    size_t m_count = 0;
+    char m_buffer[256];
+};
+
 void Json::dump(string &out) const {
-    m_ptr->dump(out);
+    JsonStringWriter writer(out);
+    dump(writer);
+}
+
+size_t Json::dump_size() const {
+    CountingWriter writer;
+    dump(writer);
+    return writer.size();
+}
+
+void Json::dump(JsonWriter &out) const {
+    switch (m_repr) {
+    case REPR_NUL:    write(out, "null"); break;
+    case REPR_BOOL:   json11::dump(m_bool, out); break;
+    case REPR_INT:    json11::dump(m_int, out); break;
+    case REPR_DOUBLE: json11::dump(m_double, out); break;
+    case REPR_STRING: json11::dump(m_string, out); break;
+    case REPR_NODE:   m_ptr->dump(out); break;
+    }
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Writers
+ */
+
+void JsonWriter::write_slow(const char *data, size_t size) {
+    while (size) {
+        if (m_pos == m_end && (m_failed || !overflow(size))) {
+            m_failed = true;
+            m_pos = m_end;
+            return;
+        }
+        const size_t n = std::min(size, static_cast<size_t>(m_end - m_pos));
+        memcpy(m_pos, data, n);
+        m_pos += n;
+        data += n;
+        size -= n;
+    }
+}
+
+bool JsonWriter::flush() {
+    if (!m_failed && !sync())
+        m_failed = true;
+    return !m_failed;
+}
+
+JsonStringWriter::JsonStringWriter(string &out, size_t size_hint) : m_out(out) {
+    if (size_hint)
+        m_out.reserve(m_out.size() + size_hint);
+    m_pos = m_buffer;
+    m_end = m_buffer + sizeof m_buffer;
+}
+
+JsonStringWriter::~JsonStringWriter() {
+    flush();
+}
+
+bool JsonStringWriter::overflow(size_t) {
+    return sync();
+}
+
+bool JsonStringWriter::sync() {
+    m_out.append(m_buffer, m_pos - m_buffer);
+    m_pos = m_buffer;
+    return true;
+}
+
+JsonBufferWriter::JsonBufferWriter(char *buffer, size_t size) : m_begin(buffer) {
+    m_pos = buffer;
+    m_end = buffer + size;
+}
+
+bool JsonBufferWriter::overflow(size_t) {
+    return false;
+}
+
+JsonFileWriter::JsonFileWriter(FILE *file) : m_file(file), m_fd(-1) {
+    m_pos = m_buffer;
+    m_end = m_buffer + sizeof m_buffer;
+}
+
+JsonFileWriter::JsonFileWriter(int fd) : m_file(nullptr), m_fd(fd) {
+    m_pos = m_buffer;
+    m_end = m_buffer + sizeof m_buffer;
+}
+
+JsonFileWriter::~JsonFileWriter() {
+    flush();
+}
+
+static long write_fd(int fd, const char *data, size_t size) {
+#ifdef _WIN32
+    return _write(fd, data, static_cast<unsigned>(std::min<size_t>(size, 1u << 30)));
+#else
+    return ::write(fd, data, size);
+#endif
+}
+
+bool JsonFileWriter::overflow(size_t) {
+    const char *data = m_buffer;
+    size_t size = m_pos - m_buffer;
+    m_pos = m_buffer;
+    while (size) {
+        long written;
+        if (m_file) {
+            written = static_cast<long>(fwrite(data, 1, size, m_file));
+            if (written == 0)
+                return false;
+        } else {
+            written = write_fd(m_fd, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool JsonFileWriter::sync() {
+    if (!overflow(0))
+        return false;
+    return !m_file || fflush(m_file) == 0;
+}
+
+JsonChunkWriter::JsonChunkWriter(size_t chunk_size) : m_chunk_size(std::max<size_t>(chunk_size, 1)) {}
+
+size_t JsonChunkWriter::size() const {
+    size_t total = 0;
+    for (const Chunk &chunk : m_chunks)
+        total += chunk.size;
+    return total;
+}
+
+string JsonChunkWriter::str() const {
+    string out;
+    out.reserve(size());
+    for (const Chunk &chunk : m_chunks)
+        out.append(chunk.data.get(), chunk.size);
+    return out;
+}
+
+bool JsonChunkWriter::overflow(size_t) {
+    sync();
+    m_chunks.push_back(Chunk { std::unique_ptr<char[]>(new char[m_chunk_size]), 0 });
+    m_pos = m_chunks.back().data.get();
+    m_end = m_pos + m_chunk_size;
+    return true;
+}
+
+bool JsonChunkWriter::sync() {
+    if (!m_chunks.empty())
+        m_chunks.back().size = m_pos - m_chunks.back().data.get();
+    return true;
 }
 
 /* * * * * * * * * * * * * * * * * * * *
@@ -158,80 +949,70 @@ protected:
         return tag;
     }
 
-    // Comparisons
-    bool equals(const JsonValue * other) const override {
-        return m_value == static_cast<const Value<tag, T> *>(other)->m_value;
-    }
-    bool less(const JsonValue * other) const override {
-        return m_value < static_cast<const Value<tag, T> *>(other)->m_value;
-    }
-
-    const T m_value;
-    void dump(string &out) const override { json11::dump(m_value, out); }
-};
-
-class JsonDouble final : public Value<Json::NUMBER, double> {
-    double number_value() const override { return m_value; }
-    int int_value() const override { return static_cast<int>(m_value); }
-    bool equals(const JsonValue * other) const override { return m_value == other->number_value(); }
-    bool less(const JsonValue * other)   const override { return m_value <  other->number_value(); }
-public:
-    explicit JsonDouble(double value) : Value(value) {}
-};
-
-class JsonInt final : public Value<Json::NUMBER, int> {
-    double number_value() const override { return m_value; }
-    int int_value() const override { return m_value; }
-    bool equals(const JsonValue * other) const override { return m_value == other->number_value(); }
-    bool less(const JsonValue * other)   const override { return m_value <  other->number_value(); }
-public:
-    explicit JsonInt(int value) : Value(value) {}
-};
-
-class JsonBoolean final : public Value<Json::BOOL, bool> {
-    bool bool_value() const override { return m_value; }
-public:
-    explicit JsonBoolean(bool value) : Value(value) {}
+    // Only changed by Json::take_array() and take_object(), when nothing else shares the value.
+    T m_value;
+    void dump(JsonWriter &out) const override { json11::dump(m_value, out); }
 };
 
-class JsonString final : public Value<Json::STRING, string> {
+class JsonString : public Value<Json::STRING, string> {
     const string &string_value() const override { return m_value; }
 public:
     explicit JsonString(const string &value) : Value(value) {}
     explicit JsonString(string &&value)      : Value(move(value)) {}
 };
 
-class JsonArray final : public Value<Json::ARRAY, Json::array> {
+class JsonArray : public Value<Json::ARRAY, Json::array> {
     const Json::array &array_items() const override { return m_value; }
     const Json & operator[](size_t i) const override;
+    Json::array *mutable_array() override { return &m_value; }
 public:
     explicit JsonArray(const Json::array &value) : Value(value) {}
     explicit JsonArray(Json::array &&value)      : Value(move(value)) {}
 };
 
-class JsonObject final : public Value<Json::OBJECT, Json::object> {
+class JsonObject : public Value<Json::OBJECT, Json::object> {
     const Json::object &object_items() const override { return m_value; }
     const Json & operator[](const string &key) const override;
+    Json::object *mutable_object() override { return &m_value; }
 public:
     explicit JsonObject(const Json::object &value) : Value(value) {}
     explicit JsonObject(Json::object &&value)      : Value(move(value)) {}
 };
 
-class JsonNull final : public Value<Json::NUL, NullStruct> {
+/* JsonBorrowedString
+ *
+ * A string that points into a buffer owned by the caller (see Json::parse_borrowed). It is
+ * only copied if someone asks for it as a std::string.
+ */
+class JsonBorrowedString final : public JsonValue {
 public:
-    JsonNull() : Value({}) {}
+    JsonBorrowedString(const char *data, size_t size) : m_data(data), m_size(size) {}
+
+private:
+    Json::Type type() const override { return Json::STRING; }
+    bool borrowed() const override { return true; }
+    void dump(JsonWriter &out) const override { json11::dump(m_data, m_size, out); }
+
+    const char * string_data() const override { return m_data; }
+    size_t string_size() const override { return m_size; }
+    const string &string_value() const override {
+        std::call_once(m_copied, [this] { m_copy.assign(m_data, m_size); });
+        return m_copy;
+    }
+
+    const char * const m_data;
+    const size_t m_size;
+    mutable std::once_flag m_copied;
+    mutable string m_copy;
 };
 
 /* * * * * * * * * * * * * * * * * * * *
  * Static globals - static-init-safe
  */
 struct Statics {
-    const std::shared_ptr<JsonValue> null = make_shared<JsonNull>();
-    const std::shared_ptr<JsonValue> t = make_shared<JsonBoolean>(true);
-    const std::shared_ptr<JsonValue> f = make_shared<JsonBoolean>(false);
     const string empty_string;
     const vector<Json> empty_vector;
-    const map<string, Json> empty_map;
+    const Json::object empty_map;
     Statics() {}
 };
 
@@ -241,7 +1022,6 @@ static const Statics & statics() {
 }
 
 static const Json & static_null() {
-    // This has to be separate, not in Statics, because Json() accesses statics().null.
     static const Json json_null;
     return json_null;
 }
@@ -250,282 +1030,1332 @@ static const Json & static_null() {
  * Constructors
  */
 
-Json::Json() noexcept                  : m_ptr(statics().null) {}
-Json::Json(std::nullptr_t) noexcept    : m_ptr(statics().null) {}
-Json::Json(double value)               : m_ptr(make_shared<JsonDouble>(value)) {}
-Json::Json(int value)                  : m_ptr(make_shared<JsonInt>(value)) {}
-Json::Json(bool value)                 : m_ptr(value ? statics().t : statics().f) {}
-Json::Json(const string &value)        : m_ptr(make_shared<JsonString>(value)) {}
-Json::Json(string &&value)             : m_ptr(make_shared<JsonString>(move(value))) {}
-Json::Json(const char * value)         : m_ptr(make_shared<JsonString>(value)) {}
-Json::Json(const Json::array &values)  : m_ptr(make_shared<JsonArray>(values)) {}
-Json::Json(Json::array &&values)       : m_ptr(make_shared<JsonArray>(move(values))) {}
-Json::Json(const Json::object &values) : m_ptr(make_shared<JsonObject>(values)) {}
-Json::Json(Json::object &&values)      : m_ptr(make_shared<JsonObject>(move(values))) {}
+Json::Json() noexcept                  : m_repr(REPR_NUL) {}
+Json::Json(std::nullptr_t) noexcept    : m_repr(REPR_NUL) {}
+Json::Json(double value)               : m_repr(REPR_DOUBLE), m_double(value) {}
+Json::Json(int value)                  : m_repr(REPR_INT), m_int(value) {}
+Json::Json(bool value)                 : m_repr(REPR_BOOL), m_bool(value) {}
+Json::Json(const char * value)         : Json(string(value)) {}
+Json::Json(const Json::array &values)  : m_repr(REPR_NODE), m_ptr(new JsonArray(values)) {}
+Json::Json(Json::array &&values)       : m_repr(REPR_NODE), m_ptr(new JsonArray(move(values))) {}
+Json::Json(const Json::object &values) : m_repr(REPR_NODE), m_ptr(new JsonObject(values)) {}
+Json::Json(Json::object &&values)      : m_repr(REPR_NODE), m_ptr(new JsonObject(move(values))) {}
+Json::Json(JsonValue *node) noexcept   : m_repr(REPR_NODE), m_ptr(node) {}
 
-/* * * * * * * * * * * * * * * * * * * *
- * Accessors
- */
+Json Json::borrowed(const char *data, size_t size) {
+    return Json(new JsonBorrowedString(data, size));
+}
 
-Json::Type Json::type()                           const { return m_ptr->type();         }
-double Json::number_value()                       const { return m_ptr->number_value(); }
-int Json::int_value()                             const { return m_ptr->int_value();    }
-bool Json::bool_value()                           const { return m_ptr->bool_value();   }
-const string & Json::string_value()               const { return m_ptr->string_value(); }
-const vector<Json> & Json::array_items()          const { return m_ptr->array_items();  }
-const map<string, Json> & Json::object_items()    const { return m_ptr->object_items(); }
-const Json & Json::operator[] (size_t i)          const { return (*m_ptr)[i];           }
-const Json & Json::operator[] (const string &key) const { return (*m_ptr)[key];         }
+Json::Json(const string &value) {
+    if (value.size() <= max_inline_string) {
+        m_repr = REPR_STRING;
+        new (&m_string) string(value);
+    } else {
+        m_repr = REPR_NODE;
+        m_ptr = new JsonString(value);
+    }
+}
 
-double                    JsonValue::number_value()              const { return 0; }
-int                       JsonValue::int_value()                 const { return 0; }
-bool                      JsonValue::bool_value()                const { return false; }
-const string &            JsonValue::string_value()              const { return statics().empty_string; }
-const vector<Json> &      JsonValue::array_items()               const { return statics().empty_vector; }
-const map<string, Json> & JsonValue::object_items()              const { return statics().empty_map; }
-const Json &              JsonValue::operator[] (size_t)         const { return static_null(); }
-const Json &              JsonValue::operator[] (const string &) const { return static_null(); }
+Json::Json(string &&value) {
+    if (value.size() <= max_inline_string) {
+        m_repr = REPR_STRING;
+        new (&m_string) string(move(value));
+    } else {
+        m_repr = REPR_NODE;
+        m_ptr = new JsonString(move(value));
+    }
+}
 
-const Json & JsonObject::operator[] (const string &key) const {
-    auto iter = m_value.find(key);
-    return (iter == m_value.end()) ? static_null() : iter->second;
-}
-const Json & JsonArray::operator[] (size_t i) const {
-    if (i >= m_value.size()) return static_null();
-    else return m_value[i];
-}
+Json::Json(const Json &other)     { copy_from(other); }
+Json::Json(Json &&other) noexcept { move_from(move(other)); }
+Json::~Json()                     { destroy(); }
 
-/* * * * * * * * * * * * * * * * * * * *
- * Comparison
- */
+// other may live inside the value being replaced (j = j["a"]), so the new value is taken
+// before the old one is released.
+Json & Json::operator=(const Json &other) {
+    if (this != &other) {
+        Json value(other);
+        destroy();
+        move_from(move(value));
+    }
+    return *this;
+}
 
-bool Json::operator== (const Json &other) const {
-    if (m_ptr == other.m_ptr)
-        return true;
-    if (m_ptr->type() != other.m_ptr->type())
-        return false;
+Json & Json::operator=(Json &&other) noexcept {
+    if (this != &other) {
+        Json value(move(other));
+        destroy();
+        move_from(move(value));
+    }
+    return *this;
+}
 
-    return m_ptr->equals(other.m_ptr.get());
+void Json::copy_from(const Json &other) {
+    m_repr = other.m_repr;
+    switch (m_repr) {
+    case REPR_NUL:    break;
+    case REPR_BOOL:   m_bool = other.m_bool; break;
+    case REPR_INT:    m_int = other.m_int; break;
+    case REPR_DOUBLE: m_double = other.m_double; break;
+    case REPR_STRING: new (&m_string) string(other.m_string); break;
+    case REPR_NODE:   m_ptr = other.m_ptr; m_ptr->retain(); break;
+    }
 }
 
-bool Json::operator< (const Json &other) const {
-    if (m_ptr == other.m_ptr)
-        return false;
-    if (m_ptr->type() != other.m_ptr->type())
-        return m_ptr->type() < other.m_ptr->type();
+// Leaves other as null.
+void Json::move_from(Json &&other) noexcept {
+    m_repr = other.m_repr;
+    switch (m_repr) {
+    case REPR_NUL:    break;
+    case REPR_BOOL:   m_bool = other.m_bool; break;
+    case REPR_INT:    m_int = other.m_int; break;
+    case REPR_DOUBLE: m_double = other.m_double; break;
+    case REPR_STRING: new (&m_string) string(move(other.m_string)); other.m_string.~string(); break;
+    // The reference moves over along with the pointer.
+    case REPR_NODE:   m_ptr = other.m_ptr; break;
+    }
+    other.m_repr = REPR_NUL;
+}
 
-    return m_ptr->less(other.m_ptr.get());
+void Json::destroy() noexcept {
+    if (m_repr == REPR_STRING)
+        m_string.~string();
+    else if (m_repr == REPR_NODE)
+        m_ptr->release();
 }
 
 /* * * * * * * * * * * * * * * * * * * *
- * Parsing
+ * Arena allocation
  */
 
-/* esc(c)
+class JsonArenaPool final {
+public:
+    explicit JsonArenaPool(size_t block_size) : m_block_size(block_size) {}
+    JsonArenaPool(const JsonArenaPool &) = delete;
+    JsonArenaPool & operator=(const JsonArenaPool &) = delete;
+
+    ~JsonArenaPool() {
+        for (char *block : m_blocks)
+            delete[] block;
+    }
+
+    void * allocate(size_t size, size_t align) {
+        size_t pad = (align - reinterpret_cast<uintptr_t>(m_cur) % align) % align;
+        if (m_cur == nullptr || size + pad > static_cast<size_t>(m_end - m_cur)) {
+            // Oversized requests get a block of their own, so that they don't waste the
+            // remainder of the current one.
+            const size_t block_size = std::max(m_block_size, size + align);
+            char *block = new char[block_size];
+            m_blocks.push_back(block);
+            m_reserved += block_size;
+            if (block_size > m_block_size) {
+                pad = (align - reinterpret_cast<uintptr_t>(block) % align) % align;
+                m_used += size;
+                return block + pad;
+            }
+            m_cur = block;
+            m_end = block + block_size;
+            pad = (align - reinterpret_cast<uintptr_t>(m_cur) % align) % align;
+        }
+        void *result = m_cur + pad;
+        m_cur += pad + size;
+        m_used += size;
+        return result;
+    }
+
+    size_t used() const { return m_used; }
+    size_t reserved() const { return m_reserved; }
+
+private:
+    const size_t m_block_size;
+    char *m_cur = nullptr;
+    char *m_end = nullptr;
+    size_t m_used = 0;
+    size_t m_reserved = 0;
+    vector<char *> m_blocks;
+};
+
+/* ArenaNode
  *
- * Format char c suitable for printing in an error message.
+ * A node placed in an arena's pool. Every one keeps a reference to the pool, so the pool stays
+ * alive for as long as any node allocated from it. Destroying a node doesn't free its memory;
+ * the pool releases all of its blocks when it is destroyed.
  */
-static inline string esc(char c) {
-    char buf[12];
-    if (static_cast<uint8_t>(c) >= 0x20 && static_cast<uint8_t>(c) <= 0x7f) {
-        snprintf(buf, sizeof buf, "'%c' (%d)", c, c);
-    } else {
-        snprintf(buf, sizeof buf, "(%d)", c);
+template <typename T>
+class ArenaNode final : public T {
+public:
+    template <typename... Args>
+    explicit ArenaNode(std::shared_ptr<JsonArenaPool> pool, Args &&... args)
+        : T(std::forward<Args>(args)...), m_pool(move(pool)) {}
+
+private:
+    void destroy() noexcept override {
+        // The pool may go with the last reference to it, so let go of it only after this.
+        std::shared_ptr<JsonArenaPool> pool = move(m_pool);
+        this->~ArenaNode();
     }
-    return string(buf);
+
+    std::shared_ptr<JsonArenaPool> m_pool;
+};
+
+template <typename T, typename... Args>
+static JsonValue * make_in_arena(const std::shared_ptr<JsonArenaPool> &pool, Args &&... args) {
+    void *memory = pool->allocate(sizeof(ArenaNode<T>), alignof(ArenaNode<T>));
+    return new (memory) ArenaNode<T>(pool, std::forward<Args>(args)...);
 }
 
-static inline bool in_range(long x, long lower, long upper) {
-    return (x >= lower && x <= upper);
+JsonArena::JsonArena(size_t block_size) : m_pool(make_shared<JsonArenaPool>(block_size)) {}
+
+// Scalars and short strings are stored inline in the Json, so they never need a node.
+Json JsonArena::make(double value)               { return Json(value); }
+Json JsonArena::make(int value)                  { return Json(value); }
+Json JsonArena::make(bool value)                 { return Json(value); }
+Json JsonArena::make(const char * value)         { return make(string(value)); }
+Json JsonArena::make(const Json::array &values)  { return Json(make_in_arena<JsonArray>(m_pool, values)); }
+Json JsonArena::make(Json::array &&values)       { return Json(make_in_arena<JsonArray>(m_pool, move(values))); }
+Json JsonArena::make(const Json::object &values) { return Json(make_in_arena<JsonObject>(m_pool, values)); }
+Json JsonArena::make(Json::object &&values)      { return Json(make_in_arena<JsonObject>(m_pool, move(values))); }
+
+Json JsonArena::make(const string &value) {
+    if (value.size() <= Json::max_inline_string)
+        return Json(value);
+    return Json(make_in_arena<JsonString>(m_pool, value));
 }
 
-namespace {
-/* JsonParser
- *
- * Object that tracks all state of an in-progress parse.
+Json JsonArena::make(string &&value) {
+    if (value.size() <= Json::max_inline_string)
+        return Json(move(value));
+    return Json(make_in_arena<JsonString>(m_pool, move(value)));
+}
+
+size_t JsonArena::bytes_used()     const { return m_pool->used(); }
+size_t JsonArena::bytes_reserved() const { return m_pool->reserved(); }
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Accessors
  */
-struct JsonParser final {
 
-    /* State
-     */
-    const string &str;
-    size_t i;
-    string &err;
-    bool failed;
-    const JsonParse strategy;
+Json::Type Json::type() const {
+    switch (m_repr) {
+    case REPR_NUL:    return NUL;
+    case REPR_BOOL:   return BOOL;
+    case REPR_INT:    return NUMBER;
+    case REPR_DOUBLE: return NUMBER;
+    case REPR_STRING: return STRING;
+    case REPR_NODE:   break;
+    }
+    return m_ptr->type();
+}
 
-    /* fail(msg, err_ret = Json())
-     *
-     * Mark this parse as failed.
-     */
-    Json fail(string &&msg) {
-        return fail(move(msg), Json());
+double Json::number_value() const {
+    switch (m_repr) {
+    case REPR_INT:    return m_int;
+    case REPR_DOUBLE: return m_double;
+    case REPR_NODE:   return m_ptr->number_value();
+    default:          return 0;
     }
+}
 
-    template <typename T>
-    T fail(string &&msg, const T err_ret) {
-        if (!failed)
-            err = std::move(msg);
-        failed = true;
-        return err_ret;
+int Json::int_value() const {
+    switch (m_repr) {
+    case REPR_INT:    return m_int;
+    case REPR_DOUBLE: return static_cast<int>(m_double);
+    case REPR_NODE:   return m_ptr->int_value();
+    default:          return 0;
     }
+}
 
-    /* consume_whitespace()
-     *
-     * Advance until the current character is non-whitespace.
-     */
-    void consume_whitespace() {
-        while (str[i] == ' ' || str[i] == '\r' || str[i] == '\n' || str[i] == '\t')
-            i++;
+bool Json::bool_value() const {
+    if (m_repr == REPR_BOOL)
+        return m_bool;
+    return m_repr == REPR_NODE ? m_ptr->bool_value() : false;
+}
+
+const string & Json::string_value() const {
+    if (m_repr == REPR_STRING)
+        return m_string;
+    return m_repr == REPR_NODE ? m_ptr->string_value() : statics().empty_string;
+}
+
+const char * Json::string_data() const {
+    if (m_repr == REPR_STRING)
+        return m_string.data();
+    return m_repr == REPR_NODE ? m_ptr->string_data() : statics().empty_string.data();
+}
+
+size_t Json::string_size() const {
+    if (m_repr == REPR_STRING)
+        return m_string.size();
+    return m_repr == REPR_NODE ? m_ptr->string_size() : 0;
+}
+
+const vector<Json> & Json::array_items() const {
+    return m_repr == REPR_NODE ? m_ptr->array_items() : statics().empty_vector;
+}
+
+const Json::object & Json::object_items() const {
+    return m_repr == REPR_NODE ? m_ptr->object_items() : statics().empty_map;
+}
+
+const Json & Json::operator[] (size_t i) const {
+    return m_repr == REPR_NODE ? (*m_ptr)[i] : static_null();
+}
+
+const Json & Json::operator[] (const string &key) const {
+    return m_repr == REPR_NODE ? (*m_ptr)[key] : static_null();
+}
+
+Json::array Json::take_array() {
+    Json::array items;
+    if (type() == ARRAY) {
+        // A node nothing else points to can't be seen by anyone else, so it is safe to gut.
+        if (m_ptr->unique())
+            items = move(*m_ptr->mutable_array());
+        else
+            items = m_ptr->array_items();
     }
+    *this = nullptr;
+    return items;
+}
 
-    /* consume_comment()
-     *
-     * Advance comments (c-style inline and multiline).
-     */
-    bool consume_comment() {
-      bool comment_found = false;
-      if (str[i] == '/') {
-        i++;
-        if (i == str.size())
-          return fail("unexpected end of input after start of comment", false);
-        if (str[i] == '/') { // inline comment
-          i++;
-          // advance until next line, or end of input
-          while (i < str.size() && str[i] != '\n') {
-            i++;
-          }
-          comment_found = true;
-        }
-        else if (str[i] == '*') { // multiline comment
-          i++;
-          if (i > str.size()-2)
-            return fail("unexpected end of input inside multi-line comment", false);
-          // advance until closing tokens
-          while (!(str[i] == '*' && str[i+1] == '/')) {
-            i++;
-            if (i > str.size()-2)
-              return fail(
-                "unexpected end of input inside multi-line comment", false);
-          }
-          i += 2;
-          comment_found = true;
-        }
+Json::object Json::take_object() {
+    Json::object items;
+    if (type() == OBJECT) {
+        if (m_ptr->unique())
+            items = move(*m_ptr->mutable_object());
         else
-          return fail("malformed comment", false);
-      }
-      return comment_found;
+            items = m_ptr->object_items();
     }
+    *this = nullptr;
+    return items;
+}
 
-    /* consume_garbage()
-     *
-     * Advance until the current character is non-whitespace and non-comment.
-     */
-    void consume_garbage() {
-      consume_whitespace();
-      if(strategy == JsonParse::COMMENTS) {
-        bool comment_found = false;
-        do {
-          comment_found = consume_comment();
-          if (failed) return;
-          consume_whitespace();
-        }
-        while(comment_found);
-      }
+const Json & Json::share() const {
+    if (m_repr != REPR_NODE || m_ptr->m_shared)
+        return *this;
+    // Nothing below a shared node is local, so there is no need to look further down.
+    m_ptr->m_shared = true;
+    if (m_ptr->type() == ARRAY) {
+        for (const Json &item : m_ptr->array_items())
+            item.share();
+    } else if (m_ptr->type() == OBJECT) {
+        for (const auto &member : m_ptr->object_items())
+            member.second.share();
     }
+    return *this;
+}
 
-    /* get_next_token()
-     *
-     * Return the next non-whitespace character. If the end of the input is reached,
-     * flag an error and return 0.
-     */
-    char get_next_token() {
-        consume_garbage();
-        if (failed) return (char)0;
-        if (i == str.size())
-            return fail("unexpected end of input", (char)0);
+double                    JsonValue::number_value()              const { return 0; }
+int                       JsonValue::int_value()                 const { return 0; }
+bool                      JsonValue::bool_value()                const { return false; }
+const string &            JsonValue::string_value()              const { return statics().empty_string; }
+const char *              JsonValue::string_data()               const { return string_value().data(); }
+size_t                    JsonValue::string_size()               const { return string_value().size(); }
+const vector<Json> &      JsonValue::array_items()               const { return statics().empty_vector; }
+const Json::object &      JsonValue::object_items()              const { return statics().empty_map; }
+const Json &              JsonValue::operator[] (size_t)         const { return static_null(); }
+const Json &              JsonValue::operator[] (const string &) const { return static_null(); }
+Json::array *             JsonValue::mutable_array()                   { return nullptr; }
+Json::object *            JsonValue::mutable_object()                  { return nullptr; }
 
-        return str[i++];
-    }
+const Json & JsonObject::operator[] (const string &key) const {
+    auto iter = m_value.find(key);
+    return (iter == m_value.end()) ? static_null() : iter->second;
+}
+const Json & JsonArray::operator[] (size_t i) const {
+    if (i >= m_value.size()) return static_null();
+    else return m_value[i];
+}
 
-    /* encode_utf8(pt, out)
-     *
-     * Encode pt as UTF-8 and add it to out.
-     */
-    void encode_utf8(long pt, string & out) {
-        if (pt < 0)
-            return;
+/* * * * * * * * * * * * * * * * * * * *
+ * Keys
+ */
 
-        if (pt < 0x80) {
-            out += static_cast<char>(pt);
-        } else if (pt < 0x800) {
-            out += static_cast<char>((pt >> 6) | 0xC0);
-            out += static_cast<char>((pt & 0x3F) | 0x80);
-        } else if (pt < 0x10000) {
-            out += static_cast<char>((pt >> 12) | 0xE0);
-            out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
-            out += static_cast<char>((pt & 0x3F) | 0x80);
-        } else {
-            out += static_cast<char>((pt >> 18) | 0xF0);
-            out += static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
-            out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
-            out += static_cast<char>((pt & 0x3F) | 0x80);
-        }
+JsonKey::Rep * JsonKey::empty_rep() noexcept {
+    static Rep empty { string(), hash_bytes(nullptr, 0), true };
+    return &empty;
+}
+
+JsonKey::JsonKey(const char *data, size_t size) : JsonKey(data, size, hash_bytes(data, size)) {}
+
+JsonKey::JsonKey(string &&key) {
+    const size_t hash = hash_bytes(key.data(), key.size());
+    m_rep = new Rep(move(key), hash, false);
+}
+
+size_t JsonKey::hash_bytes(const char *data, size_t size) {
+    // FNV-1a: keys are short, so a simple byte-at-a-time hash does well.
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
     }
+    return static_cast<size_t>(hash ^ (hash >> 32));
+}
 
-    /* parse_string()
-     *
-     * Parse a string, starting at the current position.
-     */
-    string parse_string() {
-        string out;
-        long last_escaped_codepoint = -1;
-        while (true) {
-            if (i == str.size())
-                return fail("unexpected end of input in string", "");
+int JsonKey::compare(const char *data, size_t size) const {
+    const string &key = m_rep->str;
+    const int cmp = memcmp(key.data(), data, std::min(key.size(), size));
+    if (cmp != 0)
+        return cmp;
+    return (key.size() < size) ? -1 : (key.size() > size) ? 1 : 0;
+}
 
-            char ch = str[i++];
+/* JsonKeyAtoms
+ *
+ * The contents of a JsonKeyTable: an open-addressing hash set of atoms, kept at most half
+ * full, behind a mutex.
+ */
+class JsonKeyAtoms final {
+public:
+    JsonKeyAtoms(size_t max_keys, size_t max_key_size)
+        : m_max_keys(max_keys), m_max_key_size(max_key_size) {}
 
-            if (ch == '"') {
-                encode_utf8(last_escaped_codepoint, out);
-                return out;
-            }
+    JsonKey intern(const char *data, size_t size, size_t hash) {
+        if (size > m_max_key_size)
+            return JsonKey(data, size, hash);
 
-            if (in_range(ch, 0, 0x1f))
-                return fail("unescaped " + esc(ch) + " in string", "");
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const size_t mask = m_slots.size() - 1;
+        for (size_t slot = hash & mask; !m_slots.empty() && m_slots[slot]; slot = (slot + 1) & mask) {
+            JsonKey::Rep *rep = m_slots[slot];
+            if (rep->hash == hash && rep->str.size() == size && memcmp(rep->str.data(), data, size) == 0)
+                return JsonKey(rep);
+        }
+        if (m_count >= m_max_keys)
+            return JsonKey(data, size, hash);
 
-            // The usual case: non-escaped characters
-            if (ch != '\\') {
-                encode_utf8(last_escaped_codepoint, out);
-                last_escaped_codepoint = -1;
-                out += ch;
-                continue;
-            }
+        if ((m_count + 1) * 2 > m_slots.size())
+            grow();
+        JsonKey::Rep *rep = new JsonKey::Rep(string(data, size), hash, true);
+        insert(rep);
+        m_count++;
+        return JsonKey(rep);
+    }
 
-            // Handle escapes
-            if (i == str.size())
-                return fail("unexpected end of input in string", "");
+    size_t size() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_count;
+    }
 
-            ch = str[i++];
+private:
+    void grow() {
+        vector<JsonKey::Rep *> old(m_slots.empty() ? 64 : m_slots.size() * 2, nullptr);
+        old.swap(m_slots);
+        for (JsonKey::Rep *rep : old) {
+            if (rep)
+                insert(rep);
+        }
+    }
 
-            if (ch == 'u') {
-                // Extract 4-byte escape sequence
-                string esc = str.substr(i, 4);
-                // Explicitly check length of the substring. The following loop
-                // relies on std::string returning the terminating NUL when
-                // accessing str[length]. Checking here reduces brittleness.
-                if (esc.length() < 4) {
-                    return fail("bad \\u escape: " + esc, "");
-                }
-                for (size_t j = 0; j < 4; j++) {
-                    if (!in_range(esc[j], 'a', 'f') && !in_range(esc[j], 'A', 'F')
-                            && !in_range(esc[j], '0', '9'))
-                        return fail("bad \\u escape: " + esc, "");
-                }
+    void insert(JsonKey::Rep *rep) {
+        const size_t mask = m_slots.size() - 1;
+        size_t slot = rep->hash & mask;
+        while (m_slots[slot])
+            slot = (slot + 1) & mask;
+        m_slots[slot] = rep;
+    }
 
-                long codepoint = strtol(esc.data(), nullptr, 16);
+    const size_t m_max_keys;
+    const size_t m_max_key_size;
+    std::mutex m_mutex;
+    // Atoms are deliberately never deleted: keys copied out of the table may outlive it.
+    vector<JsonKey::Rep *> m_slots;
+    size_t m_count = 0;
+};
 
-                // JSON specifies that characters outside the BMP shall be encoded as a pair
+JsonKeyTable::JsonKeyTable(size_t max_keys, size_t max_key_size)
+    : m_atoms(new JsonKeyAtoms(max_keys, max_key_size)) {}
+
+JsonKeyTable::~JsonKeyTable() {}
+
+JsonKey JsonKeyTable::intern(const char *data, size_t size) {
+    return m_atoms->intern(data, size, JsonKey::hash_bytes(data, size));
+}
+
+JsonKey JsonKeyTable::intern(const char *data, size_t size, size_t hash) {
+    return m_atoms->intern(data, size, hash);
+}
+
+size_t JsonKeyTable::size() const {
+    return m_atoms->size();
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * JsonFlatObject
+ */
+
+static bool key_less(const JsonFlatObject::value_type &member, const string &key) {
+    return member.first < key;
+}
+
+static bool member_less(const JsonFlatObject::value_type &a, const JsonFlatObject::value_type &b) {
+    return a.first < b.first;
+}
+
+void JsonFlatObject::clear() noexcept {
+    m_members.clear();
+    m_index.clear();
+}
+
+size_t JsonFlatObject::position(const string &key) const {
+    if (m_index.empty()) {
+        auto iter = std::lower_bound(m_members.begin(), m_members.end(), key, key_less);
+        return (iter != m_members.end() && iter->first == key) ? iter - m_members.begin()
+                                                                : m_members.size();
+    }
+
+    const size_t hash = JsonKey::hash_bytes(key.data(), key.size());
+    const size_t mask = m_index.size() - 1;
+    for (size_t slot = hash & mask; m_index[slot]; slot = (slot + 1) & mask) {
+        const size_t pos = m_index[slot] - 1;
+        const JsonKey &member_key = m_members[pos].first;
+        if (member_key.hash() == hash && member_key == key)
+            return pos;
+    }
+    return m_members.size();
+}
+
+JsonFlatObject::iterator JsonFlatObject::lower_bound(const string &key) {
+    return std::lower_bound(m_members.begin(), m_members.end(), key, key_less);
+}
+
+JsonFlatObject::const_iterator JsonFlatObject::lower_bound(const string &key) const {
+    return std::lower_bound(m_members.begin(), m_members.end(), key, key_less);
+}
+
+Json & JsonFlatObject::at(const string &key) {
+    const size_t pos = position(key);
+    if (pos == m_members.size())
+        throw std::out_of_range("JsonFlatObject::at: no member \"" + key + "\"");
+    return m_members[pos].second;
+}
+
+const Json & JsonFlatObject::at(const string &key) const {
+    return const_cast<JsonFlatObject *>(this)->at(key);
+}
+
+Json & JsonFlatObject::operator[](const string &key) {
+    const size_t pos = position(key);
+    if (pos != m_members.size())
+        return m_members[pos].second;
+    return insert_at(lower_bound(key) - begin(), value_type(key, Json()))->second;
+}
+
+Json & JsonFlatObject::operator[](string &&key) {
+    const size_t pos = position(key);
+    if (pos != m_members.size())
+        return m_members[pos].second;
+    const size_t where = lower_bound(key) - begin();
+    return insert_at(where, value_type(move(key), Json()))->second;
+}
+
+std::pair<JsonFlatObject::iterator, bool> JsonFlatObject::insert(value_type &&member) {
+    const size_t pos = position(member.first);
+    if (pos != m_members.size())
+        return { begin() + pos, false };
+    const size_t where = lower_bound(member.first) - begin();
+    return { insert_at(where, move(member)), true };
+}
+
+size_t JsonFlatObject::erase(const string &key) {
+    const size_t pos = position(key);
+    if (pos == m_members.size())
+        return 0;
+    erase(begin() + pos);
+    return 1;
+}
+
+JsonFlatObject::iterator JsonFlatObject::erase(const_iterator pos) {
+    const size_t where = pos - m_members.cbegin();
+    m_members.erase(m_members.begin() + where);
+    // Erasing is rare enough that it isn't worth unlinking the slot in place.
+    rebuild_index();
+    return begin() + where;
+}
+
+void JsonFlatObject::assign(vector<value_type> &&members) {
+    m_members = move(members);
+    normalize(true);
+}
+
+JsonFlatObject::iterator JsonFlatObject::insert_at(size_t pos, value_type &&member) {
+    m_members.insert(m_members.begin() + pos, move(member));
+    if (m_members.size() > index_threshold) {
+        if (m_index.size() < m_members.size() * 2) {
+            rebuild_index();
+        } else {
+            // Everything from pos on moved up by one.
+            for (uint32_t &entry : m_index) {
+                if (entry > pos)
+                    entry++;
+            }
+            index_insert(pos);
+        }
+    }
+    return begin() + pos;
+}
+
+void JsonFlatObject::normalize(bool keep_last) {
+    if (m_members.size() <= index_threshold) {
+        // Insertion sort: stable, and unlike std::stable_sort it needs no scratch buffer.
+        for (size_t i = 1; i < m_members.size(); i++) {
+            if (!member_less(m_members[i], m_members[i - 1]))
+                continue;
+            value_type member = move(m_members[i]);
+            size_t j = i;
+            do {
+                m_members[j] = move(m_members[j - 1]);
+            } while (--j > 0 && member_less(member, m_members[j - 1]));
+            m_members[j] = move(member);
+        }
+    } else if (!std::is_sorted(m_members.begin(), m_members.end(), member_less)) {
+        // Sort positions rather than the members themselves, then move each member once.
+        vector<uint32_t> order(m_members.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = static_cast<uint32_t>(i);
+        std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+            const int cmp = m_members[a].first.compare(m_members[b].first);
+            return cmp < 0 || (cmp == 0 && a < b);
+        });
+        vector<value_type> sorted;
+        sorted.reserve(m_members.size());
+        for (uint32_t pos : order)
+            sorted.push_back(move(m_members[pos]));
+        m_members.swap(sorted);
+    }
+
+    // Collapse runs of equal keys, which are adjacent and still in their original order.
+    size_t out = 0;
+    for (size_t in = 0; in < m_members.size(); in++) {
+        if (out > 0 && m_members[out - 1].first == m_members[in].first) {
+            if (keep_last)
+                m_members[out - 1].second = move(m_members[in].second);
+        } else {
+            if (out != in)
+                m_members[out] = move(m_members[in]);
+            out++;
+        }
+    }
+    m_members.erase(m_members.begin() + out, m_members.end());
+    rebuild_index();
+}
+
+void JsonFlatObject::rebuild_index() {
+    m_index.clear();
+    if (m_members.size() <= index_threshold)
+        return;
+
+    // Keep the table at most half full, so that probe sequences stay short.
+    size_t capacity = 64;
+    while (capacity < m_members.size() * 2)
+        capacity *= 2;
+    m_index.assign(capacity, 0);
+    for (size_t pos = 0; pos < m_members.size(); pos++)
+        index_insert(pos);
+}
+
+void JsonFlatObject::index_insert(size_t pos) {
+    const size_t mask = m_index.size() - 1;
+    size_t slot = m_members[pos].first.hash() & mask;
+    while (m_index[slot])
+        slot = (slot + 1) & mask;
+    m_index[slot] = static_cast<uint32_t>(pos + 1);
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * JsonBuilder
+ */
+
+JsonBuilder::JsonBuilder(Json::Type type) : m_type(type == Json::ARRAY ? Json::ARRAY : Json::OBJECT) {}
+
+JsonBuilder::JsonBuilder(Json &&value) : m_type(value.is_array() ? Json::ARRAY : Json::OBJECT) {
+    if (is_array())
+        m_array = value.take_array();
+    else
+        m_object = value.take_object();
+}
+
+JsonBuilder & JsonBuilder::set(const string &key, Json value) {
+    if (!is_array())
+        m_object[key] = move(value);
+    return *this;
+}
+
+JsonBuilder & JsonBuilder::set(string &&key, Json value) {
+    if (!is_array())
+        m_object[move(key)] = move(value);
+    return *this;
+}
+
+JsonBuilder & JsonBuilder::erase(const string &key) {
+    if (!is_array())
+        m_object.erase(key);
+    return *this;
+}
+
+JsonBuilder & JsonBuilder::push_back(Json value) {
+    if (is_array())
+        m_array.push_back(move(value));
+    return *this;
+}
+
+Json JsonBuilder::finish() {
+    if (is_array()) {
+        Json result(move(m_array));
+        m_array.clear();
+        return result;
+    }
+    Json result(move(m_object));
+    m_object.clear();
+    return result;
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Comparison
+ */
+
+bool Json::operator== (const Json &other) const {
+    if (m_repr == REPR_NODE && other.m_repr == REPR_NODE && m_ptr == other.m_ptr)
+        return true;
+    const Type t = type();
+    if (t != other.type())
+        return false;
+
+    switch (t) {
+    case NUL:    return true;
+    case BOOL:   return bool_value() == other.bool_value();
+    case NUMBER: return number_value() == other.number_value();
+    case STRING: return string_size() == other.string_size()
+                        && memcmp(string_data(), other.string_data(), string_size()) == 0;
+    default: {
+        // Arrays and objects whose hashes are known and differ can't be equal.
+        const size_t hash = m_ptr->m_hash.load(std::memory_order_relaxed);
+        const size_t other_hash = other.m_ptr->m_hash.load(std::memory_order_relaxed);
+        if (hash && other_hash && hash != other_hash)
+            return false;
+        // Compared through the accessors, as nodes of one type need not be of one class.
+        if (t == ARRAY)
+            return array_items() == other.array_items();
+        return object_items() == other.object_items();
+    }
+    }
+}
+
+bool Json::operator< (const Json &other) const {
+    if (m_repr == REPR_NODE && other.m_repr == REPR_NODE && m_ptr == other.m_ptr)
+        return false;
+    const Type t = type();
+    if (t != other.type())
+        return t < other.type();
+
+    switch (t) {
+    case NUL:    return false;
+    case BOOL:   return bool_value() < other.bool_value();
+    case NUMBER: return number_value() < other.number_value();
+    case STRING: {
+        const size_t n = std::min(string_size(), other.string_size());
+        const int c = memcmp(string_data(), other.string_data(), n);
+        return c < 0 || (c == 0 && string_size() < other.string_size());
+    }
+    case ARRAY:  return array_items() < other.array_items();
+    default:     return object_items() < other.object_items();
+    }
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Hashing and deduplication
+ */
+
+static size_t hash_combine(size_t seed, size_t value) {
+    return seed ^ (value + static_cast<size_t>(0x9e3779b97f4a7c15ull) + (seed << 6) + (seed >> 2));
+}
+
+static size_t hash_number(double value) {
+    // Every number compares by value, so 1 and 1.0 (and 0 and -0) must hash alike.
+    if (value == 0)
+        value = 0;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return hash_combine(Json::NUMBER, static_cast<size_t>(bits ^ (bits >> 32)));
+}
+
+static size_t hash_string(const char *data, size_t size) {
+    return hash_combine(Json::STRING, JsonKey::hash_bytes(data, size));
+}
+
+size_t Json::hash() const {
+    switch (m_repr) {
+    case REPR_NUL:    return hash_combine(NUL, 0);
+    case REPR_BOOL:   return hash_combine(BOOL, m_bool);
+    case REPR_INT:    return hash_number(m_int);
+    case REPR_DOUBLE: return hash_number(m_double);
+    case REPR_STRING: return hash_string(m_string.data(), m_string.size());
+    case REPR_NODE:   break;
+    }
+
+    size_t hash = m_ptr->m_hash.load(std::memory_order_relaxed);
+    if (hash)
+        return hash;
+    switch (m_ptr->type()) {
+    case ARRAY:
+        hash = hash_combine(ARRAY, m_ptr->array_items().size());
+        for (const Json &item : m_ptr->array_items())
+            hash = hash_combine(hash, item.hash());
+        break;
+    case OBJECT:
+        hash = hash_combine(OBJECT, m_ptr->object_items().size());
+        for (const auto &member : m_ptr->object_items()) {
+            const string &key = member.first;
+            hash = hash_combine(hash, JsonKey::hash_bytes(key.data(), key.size()));
+            hash = hash_combine(hash, member.second.hash());
+        }
+        break;
+    default:
+        hash = hash_string(m_ptr->string_data(), m_ptr->string_size());
+        break;
+    }
+    // Zero means "not yet computed".
+    if (hash == 0)
+        hash = 1;
+    m_ptr->m_hash.store(hash, std::memory_order_relaxed);
+    return hash;
+}
+
+Json Json::dedupe() const {
+    JsonValueTable table;
+    return table.intern(*this);
+}
+
+bool JsonValueTable::same(const Json &a, const Json &b) {
+    if (a.m_repr != b.m_repr)
+        return false;
+    return (a.m_repr == Json::REPR_NODE) ? a.m_ptr == b.m_ptr : a == b;
+}
+
+JsonValueTable::~JsonValueTable() {
+    for (JsonValue *node : m_slots) {
+        if (node)
+            node->release();
+    }
+}
+
+Json JsonValueTable::intern(const Json &value) {
+    if (value.m_repr != Json::REPR_NODE)
+        return value;
+
+    const JsonValue *node = value.m_ptr;
+    switch (node->type()) {
+    case Json::ARRAY: {
+        const Json::array &items = node->array_items();
+        Json::array interned;
+        for (size_t i = 0; i < items.size(); i++) {
+            Json item = intern(items[i]);
+            if (interned.empty() && same(item, items[i]))
+                continue;
+            // The first child that changed: copy the ones before it, which didn't.
+            if (interned.empty()) {
+                interned.reserve(items.size());
+                interned.assign(items.begin(), items.begin() + i);
+            }
+            interned.push_back(move(item));
+        }
+        return canonical(interned.empty() ? Json(value) : Json(move(interned)));
+    }
+
+    case Json::OBJECT: {
+        const Json::object &members = node->object_items();
+        vector<Json> values;
+        bool changed = false;
+        values.reserve(members.size());
+        for (const auto &member : members) {
+            values.push_back(intern(member.second));
+            changed = changed || !same(values.back(), member.second);
+        }
+        if (!changed)
+            return canonical(Json(value));
+        Json::object interned = members;
+        size_t i = 0;
+        for (auto &member : interned)
+            member.second = move(values[i++]);
+        return canonical(Json(move(interned)));
+    }
+
+    default:
+        if (node->borrowed())
+            return canonical(Json(string(node->string_data(), node->string_size())));
+        return canonical(Json(value));
+    }
+}
+
+Json JsonValueTable::canonical(Json &&candidate) {
+    if (candidate.m_repr != Json::REPR_NODE)
+        return move(candidate);
+
+    const size_t hash = candidate.hash();
+    const JsonValue *node = candidate.m_ptr;
+    if (!m_slots.empty()) {
+        const size_t mask = m_slots.size() - 1;
+        for (size_t slot = hash & mask; m_slots[slot]; slot = (slot + 1) & mask) {
+            JsonValue *other = m_slots[slot];
+            if (other == node)
+                return move(candidate);
+            if (other->m_hash.load(std::memory_order_relaxed) != hash || other->type() != node->type())
+                continue;
+
+            // Children are interned before their parents, so comparing them is enough.
+            bool equal;
+            switch (node->type()) {
+            case Json::ARRAY:
+                equal = std::equal(node->array_items().begin(), node->array_items().end(),
+                                   other->array_items().begin(), other->array_items().end(),
+                                   same);
+                break;
+            case Json::OBJECT:
+                equal = std::equal(node->object_items().begin(), node->object_items().end(),
+                                   other->object_items().begin(), other->object_items().end(),
+                                   [](const Json::object::value_type &a,
+                                      const Json::object::value_type &b) {
+                                       return a.first == b.first && same(a.second, b.second);
+                                   });
+                break;
+            default:
+                equal = node->string_size() == other->string_size()
+                        && memcmp(node->string_data(), other->string_data(), node->string_size()) == 0;
+                break;
+            }
+            if (equal) {
+                other->retain();
+                return Json(other);
+            }
+        }
+    }
+
+    if ((m_count + 1) * 2 > m_slots.size())
+        grow();
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = hash & mask;
+    while (m_slots[slot])
+        slot = (slot + 1) & mask;
+    node->retain();
+    m_slots[slot] = const_cast<JsonValue *>(node);
+    m_count++;
+    return move(candidate);
+}
+
+void JsonValueTable::grow() {
+    vector<JsonValue *> old(m_slots.empty() ? 64 : m_slots.size() * 2, nullptr);
+    old.swap(m_slots);
+    const size_t mask = m_slots.size() - 1;
+    for (JsonValue *node : old) {
+        if (!node)
+            continue;
+        size_t slot = node->m_hash.load(std::memory_order_relaxed) & mask;
+        while (m_slots[slot])
+            slot = (slot + 1) & mask;
+        m_slots[slot] = node;
+    }
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Parsing
+ */
+
+/* esc(c)
+ *
+ * Format char c suitable for printing in an error message.
+ */
+static inline string esc(char c) {
+    char buf[12];
+    if (static_cast<uint8_t>(c) >= 0x20 && static_cast<uint8_t>(c) <= 0x7f) {
+        snprintf(buf, sizeof buf, "'%c' (%d)", c, c);
+    } else {
+        snprintf(buf, sizeof buf, "(%d)", c);
+    }
+    return string(buf);
+}
+
+static inline bool in_range(long x, long lower, long upper) {
+    return (x >= lower && x <= upper);
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Number conversion
+ *
+ * parse_number() validates a number's syntax first; these helpers then convert the validated
+ * text without a trip through the C library in the common cases.
+ */
+
+static inline bool is_digit(char ch) {
+    return ch >= '0' && ch <= '9';
+}
+
+/* small_int_value(p, end)
+ *
+ * Convert [p, end): an optional '-' followed by at most 9 digits, so that it always fits.
+ */
+static inline int small_int_value(const char *p, const char *end) {
+    const bool negative = *p == '-';
+    if (negative)
+        p++;
+    int value = 0;
+    for (; p < end; p++)
+        value = value * 10 + (*p - '0');
+    return negative ? -value : value;
+}
+
+/* fast_double_value(p, end, result)
+ *
+ * Convert the JSON number [p, end) exactly when that is possible with a single IEEE
+ * multiplication or division (Clinger's fast path): the significant digits fit in 53 bits and
+ * the power of ten is exactly representable. Both operands are then exact, so the one
+ * rounding step gives the correctly rounded result, the same value strtod() returns. Return
+ * false, leaving result alone, for everything else.
+ */
+static bool fast_double_value(const char *p, const char *end, double &result) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    static const double exact_powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    const int max_exact_power = 22;
+    const double max_exact_integer = 9007199254740992.0; // 2^53
+
+    const bool negative = *p == '-';
+    if (negative)
+        p++;
+
+    // Accumulate up to 19 significant digits, which always fit in a uint64_t.
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; p < end && is_digit(*p); p++) {
+        if (digits == 19)
+            return false;
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        if (mantissa)
+            digits++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            if (digits == 19)
+                return false;
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            if (mantissa)
+                digits++;
+            exponent--;
+        }
+    }
+    if (p < end) {
+        // Exponent part; the syntax has already been checked.
+        p++;
+        const bool negative_exponent = *p == '-';
+        if (*p == '+' || *p == '-')
+            p++;
+        int e = 0;
+        for (; p < end; p++) {
+            if (e > 100000)
+                return false;
+            e = e * 10 + (*p - '0');
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+
+    if (mantissa == 0) {
+        result = negative ? -0.0 : 0.0;
+        return true;
+    }
+    if (mantissa > (uint64_t(1) << 53))
+        return false;
+
+    double value = static_cast<double>(mantissa);
+    if (exponent < 0) {
+        if (exponent < -max_exact_power)
+            return false;
+        value /= exact_powers_of_ten[-exponent];
+    } else {
+        if (exponent > max_exact_power) {
+            // 123e25 is still exact as 1230000e20: move the excess into the mantissa while it
+            // stays an integer below 2^53.
+            if (exponent > max_exact_power + 15)
+                return false;
+            value *= exact_powers_of_ten[exponent - max_exact_power];
+            if (value >= max_exact_integer)
+                return false;
+            exponent = max_exact_power;
+        }
+        value *= exact_powers_of_ten[exponent];
+    }
+    result = negative ? -value : value;
+    return true;
+#else
+    // Intermediate results may carry excess precision, which breaks the single-rounding
+    // argument above.
+    (void)p;
+    (void)end;
+    (void)result;
+    return false;
+#endif
+}
+
+namespace {
+/* Input
+ *
+ * The buffer being parsed, which need not be NUL-terminated. Reading at or past its end
+ * yields '\0', just as std::string::operator[] does at size(), so the grammar below can look
+ * ahead freely.
+ */
+struct Input final {
+    const char *ptr;
+    size_t len;
+
+    const char * data() const { return ptr; }
+    size_t size() const { return len; }
+    char operator[](size_t pos) const { return pos < len ? ptr[pos] : '\0'; }
+
+    int compare(size_t pos, size_t n, const string &s) const {
+        n = std::min(n, len - pos);
+        if (n != s.size())
+            return 1;
+        return memcmp(ptr + pos, s.data(), n);
+    }
+    string substr(size_t pos, size_t n) const {
+        return string(ptr + pos, std::min(n, len - pos));
+    }
+};
+
+/* SyntaxChecker
+ *
+ * A handler that ignores everything: running the parser with it only checks the grammar.
+ */
+struct SyntaxChecker final {
+    bool on_null()                { return true; }
+    bool on_bool(bool)            { return true; }
+    bool on_int(int)              { return true; }
+    bool on_number(double)        { return true; }
+    bool on_string(const char *, size_t) { return true; }
+    bool start_object()           { return true; }
+    bool key(const char *, size_t) { return true; }
+    bool end_object()             { return true; }
+    bool start_array()            { return true; }
+    bool end_array()              { return true; }
+    bool on_deferred(const char *, const char *, int) { return true; }
+};
+
+/* JsonParser
+ *
+ * Object that tracks all state of an in-progress parse. This is the only implementation of
+ * the grammar: it reports what it reads to a Handler (see JsonHandler for the events), and
+ * building a Json is just one such handler.
+ */
+template <typename Handler>
+struct JsonParser final {
+
+    /* State
+     */
+    const Input str;
+    size_t i;
+    string &err;
+    bool failed;
+    const JsonParse strategy;
+    Handler &handler;
+    string scratch;
+    // Arrays and objects nested deeper than this are skipped, and reported to the handler by
+    // on_deferred() rather than parsed (see Json::parse_lazy).
+    int eager_depth = max_depth;
+    // Whether skipped arrays and objects are checked against the grammar, or only matched by
+    // brackets, for input that has been checked already.
+    bool check_skipped = true;
+
+    JsonParser(const char *in, size_t length, string &err, JsonParse strategy, Handler &handler)
+        : str { in, length }, i(0), err(err), failed(false), strategy(strategy), handler(handler) {}
+
+    /* fail(msg, err_ret = false)
+     *
+     * Mark this parse as failed.
+     */
+    bool fail(string &&msg) {
+        return fail(move(msg), false);
+    }
+
+    template <typename T>
+    T fail(string &&msg, const T err_ret) {
+        if (!failed)
+            err = std::move(msg);
+        failed = true;
+        return err_ret;
+    }
+
+    /* consume_whitespace()
+     *
+     * Advance until the current character is non-whitespace.
+     */
+    void consume_whitespace() {
+        i += scan_whitespace_run(str.data() + i, str.size() - i);
+    }
+
+    /* consume_comment()
+     *
+     * Advance comments (c-style inline and multiline).
+     */
+    bool consume_comment() {
+      bool comment_found = false;
+      if (str[i] == '/') {
+        i++;
+        if (i == str.size())
+          return fail("unexpected end of input after start of comment", false);
+        if (str[i] == '/') { // inline comment
+          i++;
+          // advance until next line, or end of input
+          while (i < str.size() && str[i] != '\n') {
+            i++;
+          }
+          comment_found = true;
+        }
+        else if (str[i] == '*') { // multiline comment
+          i++;
+          if (i > str.size()-2)
+            return fail("unexpected end of input inside multi-line comment", false);
+          // advance until closing tokens
+          while (!(str[i] == '*' && str[i+1] == '/')) {
+            i++;
+            if (i > str.size()-2)
+              return fail(
+                "unexpected end of input inside multi-line comment", false);
+          }
+          i += 2;
+          comment_found = true;
+        }
+        else
+          return fail("malformed comment", false);
+      }
+      return comment_found;
+    }
+
+    /* consume_garbage()
+     *
+     * Advance until the current character is non-whitespace and non-comment.
+     */
+    void consume_garbage() {
+      consume_whitespace();
+      if(strategy == JsonParse::COMMENTS) {
+        bool comment_found = false;
+        do {
+          comment_found = consume_comment();
+          if (failed) return;
+          consume_whitespace();
+        }
+        while(comment_found);
+      }
+    }
+
+    /* get_next_token()
+     *
+     * Return the next non-whitespace character. If the end of the input is reached,
+     * flag an error and return 0.
+     */
+    char get_next_token() {
+        consume_garbage();
+        if (failed) return (char)0;
+        if (i == str.size())
+            return fail("unexpected end of input", (char)0);
+
+        return str[i++];
+    }
+
+    /* encode_utf8(pt, out)
+     *
+     * Encode pt as UTF-8 and add it to out.
+     */
+    void encode_utf8(long pt, string & out) {
+        if (pt < 0)
+            return;
+
+        if (pt < 0x80) {
+            out += static_cast<char>(pt);
+        } else if (pt < 0x800) {
+            out += static_cast<char>((pt >> 6) | 0xC0);
+            out += static_cast<char>((pt & 0x3F) | 0x80);
+        } else if (pt < 0x10000) {
+            out += static_cast<char>((pt >> 12) | 0xE0);
+            out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+            out += static_cast<char>((pt & 0x3F) | 0x80);
+        } else {
+            out += static_cast<char>((pt >> 18) | 0xF0);
+            out += static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
+            out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+            out += static_cast<char>((pt & 0x3F) | 0x80);
+        }
+    }
+
+    /* parse_string(data, size)
+     *
+     * Parse a string, starting at the current position. On success, [data, data + size) holds
+     * the decoded string: a slice of the input if it contains no escapes, otherwise the
+     * scratch buffer, which is only valid until the next call.
+     */
+    bool parse_string(const char *&data, size_t &size) {
+        // The usual case: no escapes at all, so the string can be handed out in place
+        const size_t first_run = scan_string_run(str.data() + i, str.size() - i);
+        if (i + first_run < str.size() && str[i + first_run] == '"') {
+            data = str.data() + i;
+            size = first_run;
+            i += first_run + 1;
+            return true;
+        }
+
+        string &out = scratch;
+        out.clear();
+        long last_escaped_codepoint = -1;
+        while (true) {
+            // The usual case: a run of non-escaped characters, copied in one go
+            const size_t run = scan_string_run(str.data() + i, str.size() - i);
+            if (run) {
+                encode_utf8(last_escaped_codepoint, out);
+                last_escaped_codepoint = -1;
+                out.append(str.data() + i, run);
+                i += run;
+            }
+
+            if (i == str.size())
+                return fail("unexpected end of input in string");
+
+            char ch = str[i++];
+
+            if (ch == '"') {
+                encode_utf8(last_escaped_codepoint, out);
+                data = out.data();
+                size = out.size();
+                return true;
+            }
+
+            if (ch != '\\')
+                return fail("unescaped " + esc(ch) + " in string");
+
+            // Handle escapes
+            if (i == str.size())
+                return fail("unexpected end of input in string");
+
+            ch = str[i++];
+
+            if (ch == 'u') {
+                // Extract 4-byte escape sequence
+                string esc = str.substr(i, 4);
+                // Explicitly check length of the substring. The following loop
+                // relies on std::string returning the terminating NUL when
+                // accessing str[length]. Checking here reduces brittleness.
+                if (esc.length() < 4) {
+                    return fail("bad \\u escape: " + esc);
+                }
+                for (size_t j = 0; j < 4; j++) {
+                    if (!in_range(esc[j], 'a', 'f') && !in_range(esc[j], 'A', 'F')
+                            && !in_range(esc[j], '0', '9'))
+                        return fail("bad \\u escape: " + esc);
+                }
+
+                long codepoint = strtol(esc.data(), nullptr, 16);
+
+                // JSON specifies that characters outside the BMP shall be encoded as a pair
                 // of 4-hex-digit \u escapes encoding their surrogate pair components. Check
                 // whether we're in the middle of such a beast: the previous codepoint was an
                 // escaped lead (high) surrogate, and this is a trail (low) surrogate.
@@ -537,232 +2367,1501 @@ struct JsonParser final {
                                  | (codepoint - 0xDC00)) + 0x10000, out);
                     last_escaped_codepoint = -1;
                 } else {
-                    encode_utf8(last_escaped_codepoint, out);
-                    last_escaped_codepoint = codepoint;
+                    encode_utf8(last_escaped_codepoint, out);
+                    last_escaped_codepoint = codepoint;
+                }
+
+                i += 4;
+                continue;
+            }
+
+            encode_utf8(last_escaped_codepoint, out);
+            last_escaped_codepoint = -1;
+
+            if (ch == 'b') {
+                out += '\b';
+            } else if (ch == 'f') {
+                out += '\f';
+            } else if (ch == 'n') {
+                out += '\n';
+            } else if (ch == 'r') {
+                out += '\r';
+            } else if (ch == 't') {
+                out += '\t';
+            } else if (ch == '"' || ch == '\\' || ch == '/') {
+                out += ch;
+            } else {
+                return fail("invalid escape character " + esc(ch));
+            }
+        }
+    }
+
+    /* parse_number()
+     *
+     * Parse a number, reporting it as an int if it is short enough to be one.
+     */
+    bool parse_number() {
+        size_t start_pos = i;
+
+        if (str[i] == '-')
+            i++;
+
+        // Integer part
+        if (str[i] == '0') {
+            i++;
+            if (in_range(str[i], '0', '9'))
+                return fail("leading 0s not permitted in numbers");
+        } else if (in_range(str[i], '1', '9')) {
+            i++;
+            while (in_range(str[i], '0', '9'))
+                i++;
+        } else {
+            return fail("invalid " + esc(str[i]) + " in number");
+        }
+
+        if (str[i] != '.' && str[i] != 'e' && str[i] != 'E'
+                && (i - start_pos) <= static_cast<size_t>(std::numeric_limits<int>::digits10)) {
+            return handler.on_int(small_int_value(str.data() + start_pos, str.data() + i))
+                || stopped();
+        }
+
+        // Decimal part
+        if (str[i] == '.') {
+            i++;
+            if (!in_range(str[i], '0', '9'))
+                return fail("at least one digit required in fractional part");
+
+            while (in_range(str[i], '0', '9'))
+                i++;
+        }
+
+        // Exponent part
+        if (str[i] == 'e' || str[i] == 'E') {
+            i++;
+
+            if (str[i] == '+' || str[i] == '-')
+                i++;
+
+            if (!in_range(str[i], '0', '9'))
+                return fail("at least one digit required in exponent");
+
+            while (in_range(str[i], '0', '9'))
+                i++;
+        }
+
+        // Checking the syntax doesn't need the value.
+        if (std::is_same<Handler, SyntaxChecker>::value)
+            return true;
+
+        double value;
+        if (!fast_double_value(str.data() + start_pos, str.data() + i, value))
+            value = std::strtod(number_text(start_pos), nullptr);
+        return handler.on_number(value) || stopped();
+    }
+
+    /* number_text(start_pos)
+     *
+     * Return the number just scanned, [start_pos, i), as a NUL-terminated string for strtod()
+     * to convert on the slow path. The input itself may not be terminated.
+     */
+    const char * number_text(size_t start_pos) {
+        scratch.assign(str.data() + start_pos, i - start_pos);
+        return scratch.c_str();
+    }
+
+    /* stopped()
+     *
+     * Flag an error because the handler asked to stop.
+     */
+    bool stopped() {
+        return fail("parse stopped by handler");
+    }
+
+    /* expect(str)
+     *
+     * Expect that 'str' starts at the character that was just read. If it does, advance
+     * the input and return true. If not, flag an error.
+     */
+    bool expect(const string &expected) {
+        assert(i != 0);
+        i--;
+        if (str.compare(i, expected.length(), expected) == 0) {
+            i += expected.length();
+            return true;
+        } else {
+            return fail("parse error: expected " + expected + ", got " + str.substr(i, expected.length()));
+        }
+    }
+
+    /* skip_container(depth)
+     *
+     * Advance past the array or object whose opening bracket was just read, without reporting
+     * it. Unless check_skipped is false, it must be valid, just as if it had been parsed.
+     */
+    bool skip_container(int depth) {
+        if (check_skipped) {
+            SyntaxChecker checker;
+            JsonParser<SyntaxChecker> parser { str.data(), str.size(), err, strategy, checker };
+            parser.i = i - 1;
+            parser.scratch.swap(scratch);
+            const bool valid = parser.parse_json(depth);
+            scratch.swap(parser.scratch);
+            i = parser.i;
+            if (!valid)
+                failed = true;
+            return valid;
+        }
+
+        // Match brackets outside of strings (and comments).
+        const char *p = str.data() + i;
+        const char * const end = str.data() + str.size();
+        size_t open = 1;
+        while (true) {
+            while (p < end && !is_structural_byte(*p))
+                p++;
+            if (p == end)
+                break;
+            const char ch = *p++;
+            if (ch == '"') {
+                while (true) {
+                    p += scan_string_run(p, end - p);
+                    if (p >= end) {
+                        i = str.size();
+                        return fail("unexpected end of input in string");
+                    }
+                    if (*p == '"')
+                        break;
+                    if (*p == '\\') {
+                        // Skip the escaped character along with the backslash.
+                        if (p + 1 >= end) {
+                            i = str.size();
+                            return fail("unexpected end of input in string");
+                        }
+                        p += 2;
+                    } else {
+                        p++;
+                    }
+                }
+                p++;
+            } else if (ch == '{' || ch == '[') {
+                open++;
+            } else if (ch == '}' || ch == ']') {
+                if (--open == 0) {
+                    i = p - str.data();
+                    return true;
+                }
+            } else if (strategy == JsonParse::COMMENTS) {
+                i = p - 1 - str.data();
+                consume_comment();
+                if (failed)
+                    return false;
+                p = str.data() + i;
+            }
+        }
+        i = str.size();
+        return fail("unexpected end of input");
+    }
+
+    /* parse_json()
+     *
+     * Parse a JSON value, reporting it to the handler.
+     */
+    bool parse_json(int depth) {
+        if (depth > max_depth) {
+            return fail("exceeded maximum nesting depth");
+        }
+
+        char ch = get_next_token();
+        if (failed)
+            return false;
+
+        if (ch == '-' || (ch >= '0' && ch <= '9')) {
+            i--;
+            return parse_number();
+        }
+
+        if (ch == 't')
+            return expect("true") && (handler.on_bool(true) || stopped());
+
+        if (ch == 'f')
+            return expect("false") && (handler.on_bool(false) || stopped());
+
+        if (ch == 'n')
+            return expect("null") && (handler.on_null() || stopped());
+
+        const char *data;
+        size_t size;
+
+        if (ch == '"')
+            return parse_string(data, size) && (handler.on_string(data, size) || stopped());
+
+        if ((ch == '{' || ch == '[') && depth > eager_depth) {
+            const size_t begin = i - 1;
+            return skip_container(depth)
+                && (handler.on_deferred(str.data() + begin, str.data() + i, depth) || stopped());
+        }
+
+        if (ch == '{') {
+            if (!handler.start_object())
+                return stopped();
+            ch = get_next_token();
+            if (ch == '}')
+                return handler.end_object() || stopped();
+
+            while (1) {
+                if (ch != '"')
+                    return fail("expected '\"' in object, got " + esc(ch));
+
+                if (!parse_string(data, size))
+                    return false;
+                if (!handler.key(data, size))
+                    return stopped();
+
+                ch = get_next_token();
+                if (ch != ':')
+                    return fail("expected ':' in object, got " + esc(ch));
+
+                if (!parse_json(depth + 1))
+                    return false;
+
+                ch = get_next_token();
+                if (ch == '}')
+                    break;
+                if (ch != ',')
+                    return fail("expected ',' in object, got " + esc(ch));
+
+                ch = get_next_token();
+            }
+            return handler.end_object() || stopped();
+        }
+
+        if (ch == '[') {
+            if (!handler.start_array())
+                return stopped();
+            ch = get_next_token();
+            if (ch == ']')
+                return handler.end_array() || stopped();
+
+            while (1) {
+                i--;
+                if (!parse_json(depth + 1))
+                    return false;
+
+                ch = get_next_token();
+                if (ch == ']')
+                    break;
+                if (ch != ',')
+                    return fail("expected ',' in list, got " + esc(ch));
+
+                ch = get_next_token();
+                (void)ch;
+            }
+            return handler.end_array() || stopped();
+        }
+
+        return fail("expected value, got " + esc(ch));
+    }
+
+    /* parse_document()
+     *
+     * Parse a single JSON value that must span the whole input.
+     */
+    bool parse_document() {
+        if (!parse_json(0))
+            return false;
+
+        // Check for any trailing garbage
+        consume_garbage();
+        if (failed)
+            return false;
+        if (i != str.size())
+            return fail("unexpected trailing " + esc(str[i]));
+        return true;
+    }
+};
+}//namespace {
+
+/* DomBuilder
+ *
+ * Handler that assembles the events of a parse into a Json tree.
+ */
+class DomBuilder final {
+public:
+    explicit DomBuilder(JsonArena *arena, JsonKeyTable *keys = nullptr) : m_arena(arena) {
+#ifdef JSON11_FLAT_OBJECT
+        m_key_table = keys;
+#else
+        // Keys are plain strings in a std::map, so there is nothing to intern.
+        (void)keys;
+#endif
+    }
+
+    // Let strings that are slices of [begin, end) point into it rather than copying them.
+    void borrow_from(const char *begin, const char *end) {
+        m_borrow_begin = begin;
+        m_borrow_end = end;
+    }
+
+    // Make arrays and objects the parser defers lazy nodes over source (see Json::parse_lazy).
+    void defer_from(const std::shared_ptr<const string> &source, JsonParse strategy) {
+        m_source = source;
+        m_strategy = strategy;
+    }
+
+    bool on_null()                { return add(Json()); }
+    bool on_bool(bool value)      { return add(Json(value)); }
+    bool on_int(int value)        { return add(Json(value)); }
+    bool on_number(double value)  { return add(Json(value)); }
+    bool on_string(const char *data, size_t size) {
+        if (size > Json::max_inline_string && data >= m_borrow_begin && data < m_borrow_end)
+            return add(Json::borrowed(data, size));
+        return add(make(string(data, size)));
+    }
+
+    bool start_object() {
+        m_stack.emplace_back(true);
+#ifdef JSON11_FLAT_OBJECT
+        m_stack.back().members_begin = m_members.size();
+#endif
+        return true;
+    }
+    bool key(const char *data, size_t size) {
+#ifdef JSON11_FLAT_OBJECT
+        m_stack.back().key = make_key(data, size);
+#else
+        m_stack.back().key.assign(data, size);
+#endif
+        return true;
+    }
+    bool end_object() {
+#ifdef JSON11_FLAT_OBJECT
+        // Move this object's members out of the shared buffer into one of exactly their size.
+        auto first = m_members.begin() + m_stack.back().members_begin;
+        m_stack.back().object.assign(vector<Json::object::value_type>(
+            std::make_move_iterator(first), std::make_move_iterator(m_members.end())));
+        m_members.erase(first, m_members.end());
+#endif
+        Json value = make(move(m_stack.back().object));
+        m_stack.pop_back();
+        return add(move(value));
+    }
+
+    bool start_array() {
+        m_stack.emplace_back(false);
+        return true;
+    }
+    bool end_array() {
+        Json value = make(move(m_stack.back().array));
+        m_stack.pop_back();
+        return add(move(value));
+    }
+
+    bool on_deferred(const char *begin, const char *end, int depth);
+
+    // Take the completed value, and get ready for the next one.
+    Json take() {
+        m_stack.clear();
+#ifdef JSON11_FLAT_OBJECT
+        m_members.clear();
+#endif
+        return move(m_result);
+    }
+
+private:
+    struct Frame {
+        explicit Frame(bool is_object) : is_object(is_object) {}
+        bool is_object;
+        Json::array array;
+        Json::object object;
+#ifdef JSON11_FLAT_OBJECT
+        // Where this object's members start in m_members.
+        size_t members_begin = 0;
+        JsonKey key;
+#else
+        string key;
+#endif
+    };
+
+#ifdef JSON11_FLAT_OBJECT
+    // Keys recently seen by this builder, by hash. A key that repeats within a document, as
+    // keys across an array of objects do, is then only interned or allocated once.
+    static const size_t key_cache_size = 128;
+
+    JsonKey make_key(const char *data, size_t size) {
+        const size_t hash = JsonKey::hash_bytes(data, size);
+        JsonKey &cached = m_key_cache[hash % key_cache_size];
+        if (cached.hash() != hash || cached.size() != size || memcmp(cached.data(), data, size) != 0)
+            cached = m_key_table ? m_key_table->intern(data, size, hash) : JsonKey(data, size, hash);
+        return cached;
+    }
+#endif
+
+    template <typename T>
+    Json make(T &&value) {
+        if (m_arena)
+            return m_arena->make(std::forward<T>(value));
+        return Json(std::forward<T>(value));
+    }
+
+    bool add(Json &&value) {
+        if (m_stack.empty()) {
+            m_result = move(value);
+        } else if (m_stack.back().is_object) {
+            Frame &frame = m_stack.back();
+#ifdef JSON11_FLAT_OBJECT
+            m_members.emplace_back(move(frame.key), move(value));
+#else
+            frame.object[move(frame.key)] = move(value);
+#endif
+        } else {
+            m_stack.back().array.push_back(move(value));
+        }
+        return true;
+    }
+
+    JsonArena *m_arena;
+    const char *m_borrow_begin = nullptr;
+    const char *m_borrow_end = nullptr;
+    std::shared_ptr<const string> m_source;
+    JsonParse m_strategy = JsonParse::STANDARD;
+    vector<Frame> m_stack;
+#ifdef JSON11_FLAT_OBJECT
+    // Members of every open object, in document order; each is sorted once, when it ends.
+    vector<Json::object::value_type> m_members;
+    JsonKeyTable *m_key_table = nullptr;
+    JsonKey m_key_cache[key_cache_size];
+#endif
+    Json m_result;
+};
+
+namespace {
+/* HandlerAdapter
+ *
+ * Forwards parser events to a user-supplied JsonHandler.
+ */
+struct HandlerAdapter final {
+    JsonHandler &handler;
+
+    bool on_null()                { return handler.on_null(); }
+    bool on_bool(bool value)      { return handler.on_bool(value); }
+    bool on_int(int value)        { return handler.on_int(value); }
+    bool on_number(double value)  { return handler.on_number(value); }
+    bool on_string(const char *data, size_t size) { return handler.on_string(data, size); }
+    bool start_object()           { return handler.start_object(); }
+    bool key(const char *data, size_t size) { return handler.key(data, size); }
+    bool end_object()             { return handler.end_object(); }
+    bool start_array()            { return handler.start_array(); }
+    bool end_array()              { return handler.end_array(); }
+    // parse_events() never defers anything.
+    bool on_deferred(const char *, const char *, int) { return false; }
+};
+}//namespace {
+
+static Json parse_into(const char *in, size_t length, string &err, JsonArena *arena,
+                       bool borrow, JsonParse strategy, JsonKeyTable *keys = nullptr) {
+    DomBuilder builder { arena, keys };
+    if (borrow)
+        builder.borrow_from(in, in + length);
+    JsonParser<DomBuilder> parser { in, length, err, strategy, builder };
+    if (!parser.parse_document())
+        return Json();
+    return builder.take();
+}
+
+Json Json::parse(const string &in, string &err, JsonParse strategy) {
+    return parse_into(in.data(), in.size(), err, nullptr, false, strategy);
+}
+
+Json Json::parse(const string &in, string &err, JsonArena &arena, JsonParse strategy) {
+    return parse_into(in.data(), in.size(), err, &arena, false, strategy);
+}
+
+Json Json::parse(const string &in, string &err, JsonKeyTable &keys, JsonParse strategy) {
+    return parse_into(in.data(), in.size(), err, nullptr, false, strategy, &keys);
+}
+
+Json Json::parse(const char *in, size_t length, string &err, JsonParse strategy) {
+    return parse_into(in, length, err, nullptr, false, strategy);
+}
+
+Json Json::parse_borrowed(const char *in, size_t length, string &err, JsonParse strategy) {
+    return parse_into(in, length, err, nullptr, true, strategy);
+}
+
+/* JsonLazy
+ *
+ * An array or object that is still a span of the input to Json::parse_lazy(). Its direct
+ * members are parsed the first time any of them is asked for; arrays and objects among them
+ * become lazy nodes in turn. Lazy nodes count their references atomically from the start, and
+ * so do the members they parse, as the thread that first reads a node need not be the one
+ * that made it.
+ */
+template <Json::Type tag, typename T>
+class JsonLazy : public JsonValue {
+public:
+    JsonLazy(const std::shared_ptr<const string> &source, const char *begin, const char *end,
+             int depth, JsonParse strategy)
+        : JsonValue(true), m_source(source), m_begin(begin), m_end(end), m_depth(depth),
+          m_strategy(strategy) {}
+
+protected:
+    Json::Type type() const override { return tag; }
+    void dump(JsonWriter &out) const override { json11::dump(items(), out); }
+
+    const T &items() const {
+        std::call_once(m_parsed, [this] { parse(); });
+        return m_items;
+    }
+
+private:
+    static void take(Json &value, Json::array &items)  { items = value.take_array(); }
+    static void take(Json &value, Json::object &items) { items = value.take_object(); }
+
+    void parse() const {
+        string err;
+        DomBuilder builder { nullptr };
+        builder.defer_from(m_source, m_strategy);
+        const size_t size = m_end - m_begin;
+        JsonParser<DomBuilder> parser { m_begin, size, err, m_strategy, builder };
+        parser.eager_depth = m_depth;
+        // parse_lazy() checked the whole document, so the spans below need only be matched.
+        parser.check_skipped = false;
+        const bool parsed = parser.parse_json(m_depth) && parser.i == size;
+        assert(parsed);
+        if (!parsed)
+            return;
+        Json value = builder.take();
+        value.share();
+        take(value, m_items);
+    }
+
+    const std::shared_ptr<const string> m_source;
+    const char * const m_begin;
+    const char * const m_end;
+    const int m_depth;
+    const JsonParse m_strategy;
+    mutable std::once_flag m_parsed;
+    // Only written once, by parse().
+    mutable T m_items;
+};
+
+class JsonLazyArray final : public JsonLazy<Json::ARRAY, Json::array> {
+    const Json::array &array_items() const override { return items(); }
+    const Json & operator[](size_t i) const override {
+        const Json::array &values = items();
+        return i < values.size() ? values[i] : static_null();
+    }
+    Json::array *mutable_array() override { return &const_cast<Json::array &>(items()); }
+public:
+    using JsonLazy::JsonLazy;
+};
+
+class JsonLazyObject final : public JsonLazy<Json::OBJECT, Json::object> {
+    const Json::object &object_items() const override { return items(); }
+    const Json & operator[](const string &key) const override {
+        const Json::object &values = items();
+        auto iter = values.find(key);
+        return (iter == values.end()) ? static_null() : iter->second;
+    }
+    Json::object *mutable_object() override { return &const_cast<Json::object &>(items()); }
+public:
+    using JsonLazy::JsonLazy;
+};
+
+bool DomBuilder::on_deferred(const char *begin, const char *end, int depth) {
+    if (*begin == '{')
+        return add(Json(new JsonLazyObject(m_source, begin, end, depth, m_strategy)));
+    return add(Json(new JsonLazyArray(m_source, begin, end, depth, m_strategy)));
+}
+
+Json Json::parse_lazy(string in, string &err, JsonParse strategy) {
+    const auto source = std::make_shared<const string>(move(in));
+    DomBuilder builder { nullptr };
+    builder.defer_from(source, strategy);
+    JsonParser<DomBuilder> parser { source->data(), source->size(), err, strategy, builder };
+    parser.eager_depth = 0;
+    if (!parser.parse_document())
+        return Json();
+    return builder.take();
+}
+
+bool Json::parse_events(const string &in, JsonHandler &handler, string &err, JsonParse strategy) {
+    return parse_events(in.data(), in.size(), handler, err, strategy);
+}
+
+bool Json::parse_events(const char *in, size_t length, JsonHandler &handler, string &err,
+                        JsonParse strategy) {
+    HandlerAdapter adapter { handler };
+    JsonParser<HandlerAdapter> parser { in, length, err, strategy, adapter };
+    return parser.parse_document();
+}
+
+namespace {
+/* MultiRange
+ *
+ * What parse_multi finds in the part of its input from begin up to the first value that
+ * starts at or after limit.
+ */
+struct MultiRange {
+    vector<Json> values;
+    string err;
+    bool failed = false;
+    // Where the first value was found, or the end of the input if none was.
+    size_t start = 0;
+    // Where the next range has to start, if this one did not fail.
+    size_t end = 0;
+    // Where the last value and the garbage after it ended, if any value was parsed.
+    size_t stop_pos = string::npos;
+};
+}//namespace {
+
+/* parse_multi_range(in, begin, limit, strategy, resume, out)
+ *
+ * The loop of parse_multi, over [begin, limit). With resume, begin need not be where a value
+ * starts: whitespace and comments are skipped first, to find out where the first one does.
+ */
+static void parse_multi_range(const string &in, size_t begin, size_t limit, JsonParse strategy,
+                              bool resume, MultiRange &out) {
+    DomBuilder builder { nullptr };
+    JsonParser<DomBuilder> parser { in.data(), in.size(), out.err, strategy, builder };
+    parser.i = begin;
+    if (resume)
+        parser.consume_garbage();
+    out.start = parser.i;
+    while (parser.i != in.size() && parser.i < limit && !parser.failed) {
+        parser.consume_garbage();
+        const bool is_string = !parser.failed && parser.i < in.size() && in[parser.i] == '"';
+        if (!parser.parse_json(0)) {
+            // A value that fails part-way is reported as null, or as "" if it was a string.
+            out.values.push_back(is_string ? Json("") : Json());
+            break;
+        }
+        out.values.push_back(builder.take());
+
+        // Check for another object
+        parser.consume_garbage();
+        if (parser.failed)
+            break;
+        out.stop_pos = parser.i;
+    }
+    out.failed = parser.failed;
+    out.end = parser.i;
+}
+
+// Documented in json11.hpp
+vector<Json> Json::parse_multi(const string &in,
+                               std::string::size_type &parser_stop_pos,
+                               string &err,
+                               JsonParse strategy) {
+    MultiRange range;
+    parse_multi_range(in, 0, in.size(), strategy, false, range);
+    parser_stop_pos = (range.stop_pos == string::npos) ? 0 : range.stop_pos;
+    if (range.failed)
+        err = move(range.err);
+    return move(range.values);
+}
+
+// Documented in json11.hpp
+vector<Json> Json::parse_multi_parallel(const string &in,
+                                        std::string::size_type &parser_stop_pos,
+                                        string &err,
+                                        JsonParse strategy,
+                                        unsigned threads) {
+    // Pieces smaller than this aren't worth a thread.
+    static const size_t min_piece_size = 256 * 1024;
+
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    const size_t pieces = std::min<size_t>(threads, std::max<size_t>(in.size() / min_piece_size, 1));
+
+    // Start each piece after a line break, so that in newline-delimited input it starts with
+    // a value. Whether it really does is only known once the piece before it is parsed.
+    vector<size_t> bounds { 0 };
+    for (size_t k = 1; k < pieces; k++) {
+        const size_t newline = in.find('\n', std::max(k * (in.size() / pieces), bounds.back()));
+        if (newline == string::npos || newline + 1 >= in.size())
+            break;
+        bounds.push_back(newline + 1);
+    }
+    bounds.push_back(in.size());
+
+    vector<MultiRange> ranges(bounds.size() - 1);
+    vector<std::thread> workers;
+    for (size_t k = 1; k < ranges.size(); k++) {
+        workers.emplace_back([&, k] {
+            parse_multi_range(in, bounds[k], bounds[k + 1], strategy, true, ranges[k]);
+        });
+    }
+    parse_multi_range(in, 0, bounds[1], strategy, false, ranges[0]);
+    for (std::thread &worker : workers)
+        worker.join();
+
+    // Stitch the pieces together in order, up to the first error.
+    parser_stop_pos = 0;
+    vector<Json> json_vec;
+    size_t pos = 0;
+    for (size_t k = 0; k < ranges.size() && (k == 0 || pos != in.size()); k++) {
+        MultiRange &range = ranges[k];
+        if (k > 0 && (range.start != pos || (range.failed && range.values.empty()))) {
+            // The piece didn't start where the previous one left off, so it began inside a
+            // value or comment. Parse it again from there.
+            range = MultiRange();
+            parse_multi_range(in, pos, bounds[k + 1], strategy, false, range);
+        }
+        for (Json &value : range.values)
+            json_vec.push_back(move(value));
+        if (range.stop_pos != string::npos)
+            parser_stop_pos = range.stop_pos;
+        if (range.failed) {
+            err = move(range.err);
+            break;
+        }
+        pos = range.end;
+    }
+    return json_vec;
+}
+
+/* * * * * * * * * * * * * * * * * * * *
+ * Stream parsing
+ *
+ * JsonStreamParser does not keep JsonParser itself suspended between chunks. Instead it
+ * tracks just enough structure (nesting depth, strings, escapes, comments) to find the
+ * points in the input where no value is in progress, and hands everything up to the last
+ * such point to an ordinary parse. Only the text after it is carried over to the next chunk.
+ */
+
+JsonStreamParser::JsonStreamParser(Callback callback, JsonParse strategy)
+    : m_callback(move(callback)), m_strategy(strategy) {}
+
+bool JsonStreamParser::feed(const char *data, size_t length) {
+    if (m_failed)
+        return false;
+
+    size_t pos = 0;
+    if (!m_buffer.empty()) {
+        // Complete the value carried over from the last chunk, and parse it on its own, so
+        // that the rest of this chunk can be parsed without copying it.
+        pos = scan(data, length, true);
+        if (pos == string::npos) {
+            m_buffer.append(data, length);
+            return true;
+        }
+        m_buffer.append(data, pos);
+        // One byte past the value is all an error message can quote from the next one.
+        if (pos < length)
+            m_buffer += data[pos];
+        if (!parse_values(m_buffer.data(), m_buffer.size() - (pos < length), m_buffer.size()))
+            return false;
+        m_buffer.clear();
+    }
+
+    const size_t end = pos + scan(data + pos, length - pos, false);
+    if (!parse_values(data + pos, end - pos, length - pos))
+        return false;
+    m_buffer.assign(data + end, length - end);
+    return true;
+}
+
+bool JsonStreamParser::finish() {
+    const bool ok = !m_failed && parse_values(m_buffer.data(), m_buffer.size(), m_buffer.size());
+    m_buffer.clear();
+    m_failed = false;
+    m_state = BETWEEN;
+    m_comment = NO_COMMENT;
+    m_escape = false;
+    m_depth = 0;
+    return ok;
+}
+
+/* scan(data, length, stop_at_first)
+ *
+ * Advance the structural state over [data, data + length) and return the last offset at which
+ * no value or comment was in progress, or with stop_at_first the first one. Return npos if
+ * there is none.
+ */
+size_t JsonStreamParser::scan(const char *data, size_t length, bool stop_at_first) {
+    const bool comments = (m_strategy == JsonParse::COMMENTS);
+    size_t boundary = string::npos;
+    size_t i = 0;
+    for (;;) {
+        if (m_state == BETWEEN && m_comment == NO_COMMENT) {
+            if (stop_at_first)
+                return i;
+            i += scan_whitespace_run(data + i, length - i);
+            boundary = i;
+        }
+        if (i == length)
+            return boundary;
+
+        const char ch = data[i];
+        if (m_comment != NO_COMMENT) {
+            if (m_comment == COMMENT_SLASH) {
+                if (ch == '/') {
+                    m_comment = LINE_COMMENT;
+                } else if (ch == '*') {
+                    m_comment = BLOCK_COMMENT;
+                } else {
+                    // Not a comment after all. Between values this is garbage, which is left
+                    // for the parser to report; inside a container the byte is looked at again.
+                    m_comment = NO_COMMENT;
+                    if (m_state == BETWEEN)
+                        m_state = SCALAR;
+                    continue;
                 }
+            } else if (m_comment == LINE_COMMENT) {
+                if (ch == '\n')
+                    m_comment = NO_COMMENT;
+            } else if (ch == '*') {
+                m_comment = BLOCK_COMMENT_STAR;
+            } else {
+                m_comment = (m_comment == BLOCK_COMMENT_STAR && ch == '/') ? NO_COMMENT
+                                                                         : BLOCK_COMMENT;
+            }
+            i++;
+            continue;
+        }
 
-                i += 4;
-                continue;
+        switch (m_state) {
+        case BETWEEN:
+            if (ch == '{' || ch == '[') {
+                m_state = CONTAINER;
+                m_depth = 1;
+            } else if (ch == '"') {
+                m_state = STRING;
+            } else if (ch == '/' && comments) {
+                m_comment = COMMENT_SLASH;
+            } else {
+                m_state = SCALAR;
             }
+            i++;
+            break;
 
-            encode_utf8(last_escaped_codepoint, out);
-            last_escaped_codepoint = -1;
+        case SCALAR:
+            // A number or literal runs until something that cannot be part of one; that byte
+            // belongs to whatever comes next.
+            if (is_whitespace_byte(ch) || ch == '{' || ch == '}' || ch == '[' || ch == ']'
+                || ch == '"' || ch == ',' || ch == ':' || (ch == '/' && comments))
+                m_state = BETWEEN;
+            else
+                i++;
+            break;
 
-            if (ch == 'b') {
-                out += '\b';
-            } else if (ch == 'f') {
-                out += '\f';
-            } else if (ch == 'n') {
-                out += '\n';
-            } else if (ch == 'r') {
-                out += '\r';
-            } else if (ch == 't') {
-                out += '\t';
-            } else if (ch == '"' || ch == '\\' || ch == '/') {
-                out += ch;
-            } else {
-                return fail("invalid escape character " + esc(ch), "");
+        case STRING:
+            if (m_escape) {
+                m_escape = false;
+                i++;
+                break;
+            }
+            i += scan_string_run(data + i, length - i);
+            if (i == length)
+                break;
+            if (data[i] == '\\')
+                m_escape = true;
+            else if (data[i] == '"')
+                m_state = m_depth ? CONTAINER : BETWEEN;
+            i++;
+            break;
+
+        case CONTAINER:
+            if (ch == '"') {
+                m_state = STRING;
+            } else if (ch == '{' || ch == '[') {
+                m_depth++;
+            } else if (ch == '}' || ch == ']') {
+                if (--m_depth == 0)
+                    m_state = BETWEEN;
+            } else if (ch == '/' && comments) {
+                m_comment = COMMENT_SLASH;
             }
+            i++;
+            break;
         }
     }
+}
 
-    /* parse_number()
-     *
-     * Parse a double.
-     */
-    Json parse_number() {
-        size_t start_pos = i;
+/* parse_values(data, length, available)
+ *
+ * Parse the values in [data, data + length), which ends where scan() found no value in
+ * progress. The text that follows, up to data + available, is only looked at to word the
+ * error for a value that fails, so that it reads as it would from parse_multi.
+ */
+bool JsonStreamParser::parse_values(const char *data, size_t length, size_t available) {
+    DomBuilder builder { nullptr };
+    JsonParser<DomBuilder> parser { data, length, m_error, m_strategy, builder };
+    for (;;) {
+        const size_t start = parser.i;
+        parser.consume_garbage();
+        if (!parser.failed && parser.i == length)
+            return true;
+        if (parser.failed || !parser.parse_json(0)) {
+            if (available > length) {
+                string err;
+                DomBuilder discard { nullptr };
+                JsonParser<DomBuilder> retry { data + start, available - start, err, m_strategy,
+                                               discard };
+                retry.consume_garbage();
+                if (retry.failed || !retry.parse_json(0))
+                    m_error = move(err);
+            }
+            m_failed = true;
+            return false;
+        }
+        m_callback(builder.take());
+    }
+}
 
-        if (str[i] == '-')
-            i++;
+/* * * * * * * * * * * * * * * * * * * *
+ * Binary encoding
+ *
+ * Values are encoded as CBOR (RFC 8949): null, booleans, integers, floats, text strings,
+ * arrays and maps, each prefixed with its length where it has one. Shared strings use the
+ * stringref extension (http://cbor.schmorp.de/stringref): inside a tag 256 namespace, every
+ * string at least as long as its reference would be gets the next index, and tag 25 followed
+ * by that index stands for it from then on.
+ */
 
-        // Integer part
-        if (str[i] == '0') {
-            i++;
-            if (in_range(str[i], '0', '9'))
-                return fail("leading 0s not permitted in numbers");
-        } else if (in_range(str[i], '1', '9')) {
-            i++;
-            while (in_range(str[i], '0', '9'))
-                i++;
+enum CborMajor : uint8_t {
+    CBOR_UNSIGNED = 0, CBOR_NEGATIVE = 1, CBOR_BYTES = 2, CBOR_TEXT = 3,
+    CBOR_ARRAY = 4, CBOR_MAP = 5, CBOR_TAG = 6, CBOR_SIMPLE = 7
+};
+
+static const uint64_t cbor_tag_stringref = 25;
+static const uint64_t cbor_tag_stringref_namespace = 256;
+
+// The shortest string that is given an index when the table already holds count strings.
+static size_t stringref_min_length(size_t count) {
+    if (count < 24)
+        return 3;
+    if (count < 256)
+        return 4;
+    if (count < 65536)
+        return 5;
+    if (count < 4294967296ULL)
+        return 7;
+    return 11;
+}
+
+namespace {
+struct CborEncoder final {
+    JsonWriter &out;
+    const bool share_strings;
+    std::unordered_map<string, uint64_t> strings;
+
+    void head(uint8_t major, uint64_t value) {
+        char buf[9];
+        size_t size;
+        if (value < 24) {
+            buf[0] = static_cast<char>(major << 5 | value);
+            size = 1;
         } else {
-            return fail("invalid " + esc(str[i]) + " in number");
+            const int bytes = value <= 0xff ? 1 : value <= 0xffff ? 2 : value <= 0xffffffff ? 4 : 8;
+            buf[0] = static_cast<char>(major << 5 | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27));
+            for (int k = 0; k < bytes; k++)
+                buf[bytes - k] = static_cast<char>(value >> (8 * k));
+            size = 1 + bytes;
         }
+        out.write(buf, size);
+    }
 
-        if (str[i] != '.' && str[i] != 'e' && str[i] != 'E'
-                && (i - start_pos) <= static_cast<size_t>(std::numeric_limits<int>::digits10)) {
-            return std::atoi(str.c_str() + start_pos);
+    void encode_string(const char *data, size_t size) {
+        if (share_strings) {
+            auto iter = strings.find(string(data, size));
+            if (iter != strings.end()) {
+                head(CBOR_TAG, cbor_tag_stringref);
+                head(CBOR_UNSIGNED, iter->second);
+                return;
+            }
+            if (size >= stringref_min_length(strings.size()))
+                strings.emplace(string(data, size), strings.size());
         }
+        head(CBOR_TEXT, size);
+        out.write(data, size);
+    }
 
-        // Decimal part
-        if (str[i] == '.') {
-            i++;
-            if (!in_range(str[i], '0', '9'))
-                return fail("at least one digit required in fractional part");
+    void encode_number(double value) {
+        // Integral values go out as integers, which decode back to an equal Json that dumps
+        // the same way; the exception is -0, which would lose its sign.
+        if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0
+            && !(value == 0 && std::signbit(value))) {
+            if (value >= 0)
+                head(CBOR_UNSIGNED, static_cast<uint64_t>(value));
+            else
+                head(CBOR_NEGATIVE, static_cast<uint64_t>(-1 - value));
+            return;
+        }
 
-            while (in_range(str[i], '0', '9'))
-                i++;
+        char buf[9];
+        const float narrow = static_cast<float>(value);
+        if (static_cast<double>(narrow) == value || value != value) {
+            uint32_t bits;
+            memcpy(&bits, &narrow, sizeof bits);
+            buf[0] = static_cast<char>(CBOR_SIMPLE << 5 | 26);
+            for (int k = 0; k < 4; k++)
+                buf[4 - k] = static_cast<char>(bits >> (8 * k));
+            out.write(buf, 5);
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof bits);
+            buf[0] = static_cast<char>(CBOR_SIMPLE << 5 | 27);
+            for (int k = 0; k < 8; k++)
+                buf[8 - k] = static_cast<char>(bits >> (8 * k));
+            out.write(buf, 9);
         }
+    }
 
-        // Exponent part
-        if (str[i] == 'e' || str[i] == 'E') {
-            i++;
+    void encode(const Json &value) {
+        switch (value.type()) {
+        case Json::NUL:
+            out.write(static_cast<char>(CBOR_SIMPLE << 5 | 22));
+            break;
+        case Json::BOOL:
+            out.write(static_cast<char>(CBOR_SIMPLE << 5 | (value.bool_value() ? 21 : 20)));
+            break;
+        case Json::NUMBER:
+            encode_number(value.number_value());
+            break;
+        case Json::STRING:
+            encode_string(value.string_data(), value.string_size());
+            break;
+        case Json::ARRAY:
+            head(CBOR_ARRAY, value.array_items().size());
+            for (const Json &item : value.array_items())
+                encode(item);
+            break;
+        case Json::OBJECT:
+            head(CBOR_MAP, value.object_items().size());
+            for (const auto &kv : value.object_items()) {
+                encode_string(kv.first.data(), kv.first.size());
+                encode(kv.second);
+            }
+            break;
+        }
+    }
+};
+}//namespace {
 
-            if (str[i] == '+' || str[i] == '-')
-                i++;
+void Json::to_binary(string &out, bool share_strings) const {
+    JsonStringWriter writer(out);
+    to_binary(writer, share_strings);
+}
 
-            if (!in_range(str[i], '0', '9'))
-                return fail("at least one digit required in exponent");
+void Json::to_binary(JsonWriter &writer, bool share_strings) const {
+    CborEncoder encoder { writer, share_strings, {} };
+    if (share_strings)
+        encoder.head(CBOR_TAG, cbor_tag_stringref_namespace);
+    encoder.encode(*this);
+}
 
-            while (in_range(str[i], '0', '9'))
-                i++;
-        }
+namespace {
+struct CborDecoder final {
+    const uint8_t *p;
+    const uint8_t *const end;
+    string &err;
+    bool failed = false;
+    // Strings given an index so far, in each enclosing stringref namespace.
+    vector<vector<string>> namespaces;
 
-        return std::strtod(str.c_str() + start_pos, nullptr);
+    Json fail(string &&msg) {
+        if (!failed)
+            err = move(msg);
+        failed = true;
+        return Json();
     }
 
-    /* expect(str, res)
-     *
-     * Expect that 'str' starts at the character that was just read. If it does, advance
-     * the input and return res. If not, flag an error.
-     */
-    Json expect(const string &expected, Json res) {
-        assert(i != 0);
-        i--;
-        if (str.compare(i, expected.length(), expected) == 0) {
-            i += expected.length();
-            return res;
-        } else {
-            return fail("parse error: expected " + expected + ", got " + str.substr(i, expected.length()));
+    size_t remaining() const {
+        return end - p;
+    }
+
+    // Read the head of the next item: its major type, and its argument. Indefinite lengths
+    // are returned with indefinite set.
+    bool head(uint8_t &major, uint64_t &value, bool &indefinite) {
+        if (p == end) {
+            fail("unexpected end of input");
+            return false;
         }
+        major = *p >> 5;
+        const uint8_t info = *p++ & 0x1f;
+        indefinite = false;
+        if (info < 24) {
+            value = info;
+            return true;
+        }
+        if (info == 31 && (major == CBOR_BYTES || major == CBOR_TEXT || major == CBOR_ARRAY
+                           || major == CBOR_MAP || major == CBOR_SIMPLE)) {
+            indefinite = true;
+            value = 0;
+            return true;
+        }
+        if (info > 27) {
+            fail("invalid additional information " + std::to_string(info));
+            return false;
+        }
+        const size_t bytes = size_t(1) << (info - 24);
+        if (remaining() < bytes) {
+            fail("unexpected end of input");
+            return false;
+        }
+        value = 0;
+        for (size_t k = 0; k < bytes; k++)
+            value = value << 8 | *p++;
+        return true;
     }
 
-    /* parse_json()
-     *
-     * Parse a JSON object.
-     */
-    Json parse_json(int depth) {
-        if (depth > max_depth) {
-            return fail("exceeded maximum nesting depth");
+    bool is_break() const {
+        return p != end && *p == 0xff;
+    }
+
+    // Read the body of a string whose head has been read, with indefinite-length strings
+    // assembled from their chunks.
+    bool read_string(uint8_t major, uint64_t size, bool indefinite, string &out) {
+        if (!indefinite) {
+            if (size > remaining()) {
+                fail("unexpected end of input in string");
+                return false;
+            }
+            out.assign(reinterpret_cast<const char *>(p), size);
+            p += size;
+            if (!namespaces.empty() && size >= stringref_min_length(namespaces.back().size()))
+                namespaces.back().push_back(out);
+            return true;
+        }
+        out.clear();
+        for (;;) {
+            if (is_break()) {
+                p++;
+                return true;
+            }
+            uint8_t chunk_major;
+            uint64_t chunk_size;
+            bool chunk_indefinite;
+            if (!head(chunk_major, chunk_size, chunk_indefinite))
+                return false;
+            if (chunk_major != major || chunk_indefinite) {
+                fail("invalid chunk in indefinite-length string");
+                return false;
+            }
+            if (chunk_size > remaining()) {
+                fail("unexpected end of input in string");
+                return false;
+            }
+            out.append(reinterpret_cast<const char *>(p), chunk_size);
+            p += chunk_size;
         }
+    }
 
-        char ch = get_next_token();
-        if (failed)
-            return Json();
+    // Read a map key, which must be a string or a reference to one.
+    bool read_key(string &key) {
+        uint8_t major;
+        uint64_t value;
+        bool indefinite;
+        if (!head(major, value, indefinite))
+            return false;
+        if (major == CBOR_BYTES || major == CBOR_TEXT)
+            return read_string(major, value, indefinite, key);
+        if (major == CBOR_TAG && value == cbor_tag_stringref)
+            return read_reference(key);
+        fail("map key is not a string");
+        return false;
+    }
 
-        if (ch == '-' || (ch >= '0' && ch <= '9')) {
-            i--;
-            return parse_number();
+    bool read_reference(string &out) {
+        uint8_t major;
+        uint64_t index;
+        bool indefinite;
+        if (!head(major, index, indefinite))
+            return false;
+        if (major != CBOR_UNSIGNED || namespaces.empty() || index >= namespaces.back().size()) {
+            fail("invalid string reference");
+            return false;
         }
+        out = namespaces.back()[index];
+        return true;
+    }
 
-        if (ch == 't')
-            return expect("true", true);
+    static double half_to_double(uint16_t half) {
+        const int exponent = (half >> 10) & 0x1f;
+        const int mantissa = half & 0x3ff;
+        double value;
+        if (exponent == 0)
+            value = std::ldexp(mantissa, -24);
+        else if (exponent != 31)
+            value = std::ldexp(mantissa + 1024, exponent - 25);
+        else
+            value = mantissa == 0 ? std::numeric_limits<double>::infinity()
+                                  : std::numeric_limits<double>::quiet_NaN();
+        return (half & 0x8000) ? -value : value;
+    }
 
-        if (ch == 'f')
-            return expect("false", false);
+    Json decode(int depth) {
+        if (depth > max_depth)
+            return fail("exceeded maximum nesting depth");
 
-        if (ch == 'n')
-            return expect("null", Json());
+        const uint8_t *const start = p;
+        uint8_t major;
+        uint64_t value;
+        bool indefinite;
+        if (!head(major, value, indefinite))
+            return Json();
 
-        if (ch == '"')
-            return parse_string();
+        switch (major) {
+        case CBOR_UNSIGNED:
+            if (value <= static_cast<uint64_t>(std::numeric_limits<int>::max()))
+                return Json(static_cast<int>(value));
+            return Json(static_cast<double>(value));
 
-        if (ch == '{') {
-            map<string, Json> data;
-            ch = get_next_token();
-            if (ch == '}')
-                return data;
+        case CBOR_NEGATIVE:
+            if (value <= static_cast<uint64_t>(std::numeric_limits<int>::max()))
+                return Json(-1 - static_cast<int>(value));
+            return Json(-1.0 - static_cast<double>(value));
 
-            while (1) {
-                if (ch != '"')
-                    return fail("expected '\"' in object, got " + esc(ch));
+        case CBOR_BYTES:
+        case CBOR_TEXT: {
+            string text;
+            if (!read_string(major, value, indefinite, text))
+                return Json();
+            return Json(move(text));
+        }
 
-                string key = parse_string();
+        case CBOR_ARRAY: {
+            Json::array items;
+            if (!indefinite)
+                items.reserve(std::min<uint64_t>(value, remaining()));
+            for (uint64_t k = 0; indefinite ? !is_break() : k < value; k++) {
+                items.push_back(decode(depth + 1));
                 if (failed)
                     return Json();
+            }
+            if (indefinite)
+                p++;
+            return Json(move(items));
+        }
 
-                ch = get_next_token();
-                if (ch != ':')
-                    return fail("expected ':' in object, got " + esc(ch));
-
-                data[std::move(key)] = parse_json(depth + 1);
+        case CBOR_MAP: {
+            Json::object items;
+            for (uint64_t k = 0; indefinite ? !is_break() : k < value; k++) {
+                string key;
+                if (!read_key(key))
+                    return Json();
+                Json item = decode(depth + 1);
                 if (failed)
                     return Json();
+                items[move(key)] = move(item);
+            }
+            if (indefinite)
+                p++;
+            return Json(move(items));
+        }
 
-                ch = get_next_token();
-                if (ch == '}')
-                    break;
-                if (ch != ',')
-                    return fail("expected ',' in object, got " + esc(ch));
+        case CBOR_TAG:
+            if (value == cbor_tag_stringref) {
+                string text;
+                if (!read_reference(text))
+                    return Json();
+                return Json(move(text));
+            }
+            if (value == cbor_tag_stringref_namespace) {
+                namespaces.emplace_back();
+                Json result = decode(depth + 1);
+                namespaces.pop_back();
+                return result;
+            }
+            if (value >= 2 && value <= 5)
+                return fail("unsupported tag " + std::to_string(value));
+            // Other tags only add meaning to the item they enclose; keep the item.
+            return decode(depth + 1);
 
-                ch = get_next_token();
+        case CBOR_SIMPLE:
+        default:
+            if (indefinite) {
+                p = start;
+                return fail("unexpected break");
+            }
+            switch (*start & 0x1f) {
+            case 20: return Json(false);
+            case 21: return Json(true);
+            case 22:
+            case 23: return Json();
+            case 25: return Json(half_to_double(static_cast<uint16_t>(value)));
+            case 26: {
+                const uint32_t bits = static_cast<uint32_t>(value);
+                float result;
+                memcpy(&result, &bits, sizeof result);
+                return Json(static_cast<double>(result));
+            }
+            case 27: {
+                double result;
+                memcpy(&result, &value, sizeof result);
+                return Json(result);
+            }
+            default:
+                return fail("unsupported simple value " + std::to_string(value));
             }
-            return data;
         }
+    }
+};
+}//namespace {
 
-        if (ch == '[') {
-            vector<Json> data;
-            ch = get_next_token();
-            if (ch == ']')
-                return data;
+Json Json::from_binary(const char *data, size_t size, string &err) {
+    const uint8_t *begin = reinterpret_cast<const uint8_t *>(data);
+    CborDecoder decoder { begin, begin + size, err, false, {} };
+    Json result = decoder.decode(0);
+    if (decoder.failed)
+        return Json();
+    if (decoder.p != decoder.end) {
+        err = "unexpected trailing data";
+        return Json();
+    }
+    return result;
+}
 
-            while (1) {
-                i--;
-                data.push_back(parse_json(depth + 1));
-                if (failed)
-                    return Json();
+/* * * * * * * * * * * * * * * * * * * *
+ * JSON Pointer
+ */
 
-                ch = get_next_token();
-                if (ch == ']')
-                    break;
-                if (ch != ',')
-                    return fail("expected ',' in list, got " + esc(ch));
+bool JsonPath::parse_token(const char *begin, const char *end, Token &token, string &err) {
+    token.key.clear();
+    for (const char *p = begin; p != end; p++) {
+        if (*p != '~') {
+            token.key += *p;
+        } else if (p + 1 != end && (p[1] == '0' || p[1] == '1')) {
+            token.key += (p[1] == '0') ? '~' : '/';
+            p++;
+        } else {
+            err = "invalid escape in JSON pointer: '~' must be followed by '0' or '1'";
+            return false;
+        }
+    }
 
-                ch = get_next_token();
-                (void)ch;
-            }
-            return data;
+    // Array indices are "0", or digits without a leading zero.
+    token.index = string::npos;
+    const string &key = token.key;
+    if (key.empty() || (key[0] == '0' && key.size() > 1))
+        return true;
+    size_t index = 0;
+    for (char ch : key) {
+        if (!is_digit(ch) || index > (std::numeric_limits<size_t>::max() - 9) / 10)
+            return true;
+        index = index * 10 + (ch - '0');
+    }
+    token.index = index;
+    return true;
+}
+
+JsonPath JsonPath::parse(const string &pointer, string &err) {
+    JsonPath path;
+    if (!pointer.empty() && pointer[0] != '/') {
+        err = "JSON pointer must be empty or start with '/'";
+        path.m_valid = false;
+        return path;
+    }
+    const char *p = pointer.data();
+    const char *const end = p + pointer.size();
+    while (p != end) {
+        const char *const begin = p + 1;
+        p = std::find(begin, end, '/');
+        Token token;
+        if (!parse_token(begin, p, token, err)) {
+            path.m_tokens.clear();
+            path.m_valid = false;
+            return path;
         }
+        path.m_tokens.push_back(move(token));
+    }
+    return path;
+}
 
-        return fail("expected value, got " + esc(ch));
+// The member or element of value that token refers to, or nullptr.
+static const Json * step(const Json &value, const string &key, size_t index) {
+    if (value.is_object()) {
+        const Json::object &items = value.object_items();
+        auto iter = items.find(key);
+        return (iter == items.end()) ? nullptr : &iter->second;
     }
-};
-}//namespace {
+    if (value.is_array() && index < value.array_items().size())
+        return &value.array_items()[index];
+    return nullptr;
+}
 
-Json Json::parse(const string &in, string &err, JsonParse strategy) {
-    JsonParser parser { in, 0, err, false, strategy };
-    Json result = parser.parse_json(0);
+const Json * JsonPath::find(const Json &root) const {
+    if (!m_valid)
+        return nullptr;
+    const Json *value = &root;
+    for (const Token &token : m_tokens) {
+        value = step(*value, token.key, token.index);
+        if (!value)
+            return nullptr;
+    }
+    return value;
+}
 
-    // Check for any trailing garbage
-    parser.consume_garbage();
-    if (parser.failed)
-        return Json();
-    if (parser.i != in.size())
-        return parser.fail("unexpected trailing " + esc(in[parser.i]));
+const Json & JsonPath::get(const Json &root) const {
+    const Json *value = find(root);
+    return value ? *value : static_null();
+}
 
-    return result;
+JsonPathSet::JsonPathSet() : m_nodes(1) {}
+
+int JsonPathSet::add(const string &pointer, string &err) {
+    JsonPath path = JsonPath::parse(pointer, err);
+    if (!path.valid())
+        return -1;
+
+    uint32_t node = 0;
+    for (JsonPath::Token &token : path.m_tokens) {
+        vector<uint32_t> &children = m_nodes[node].children;
+        auto iter = std::lower_bound(children.begin(), children.end(), token.key,
+                                     [this](uint32_t child, const string &key) {
+                                         return m_nodes[child].token.key < key;
+                                     });
+        if (iter != children.end() && m_nodes[*iter].token.key == token.key) {
+            node = *iter;
+            continue;
+        }
+        const uint32_t child = static_cast<uint32_t>(m_nodes.size());
+        children.insert(iter, child);
+        m_nodes.emplace_back();
+        m_nodes.back().token = move(token);
+        node = child;
+    }
+    m_nodes[node].paths.push_back(static_cast<uint32_t>(m_count));
+    return static_cast<int>(m_count++);
 }
 
-// Documented in json11.hpp
-vector<Json> Json::parse_multi(const string &in,
-                               std::string::size_type &parser_stop_pos,
-                               string &err,
-                               JsonParse strategy) {
-    JsonParser parser { in, 0, err, false, strategy };
-    parser_stop_pos = 0;
-    vector<Json> json_vec;
-    while (parser.i != in.size() && !parser.failed) {
-        json_vec.push_back(parser.parse_json(0));
-        if (parser.failed)
-            break;
+void JsonPathSet::find(const Json &root, vector<const Json *> &results) const {
+    results.assign(m_count, nullptr);
+    if (m_count)
+        visit(0, root, results.data());
+}
 
-        // Check for another object
-        parser.consume_garbage();
-        if (parser.failed)
-            break;
-        parser_stop_pos = parser.i;
+void JsonPathSet::visit(uint32_t node, const Json &value, const Json **results) const {
+    const Node &n = m_nodes[node];
+    for (uint32_t path : n.paths)
+        results[path] = &value;
+    if (n.children.empty())
+        return;
+
+    if (value.is_object() && n.children.size() * 4 >= value.object_items().size()) {
+        // Asking for a good share of the members: walk them alongside the children, which are
+        // in the same order, rather than looking each one up.
+        const Json::object &items = value.object_items();
+        auto item = items.begin();
+        for (uint32_t child : n.children) {
+            const string &key = m_nodes[child].token.key;
+            while (item != items.end() && item->first < key)
+                ++item;
+            if (item == items.end())
+                break;
+            if (item->first == key)
+                visit(child, item->second, results);
+        }
+        return;
+    }
+
+    for (uint32_t child : n.children) {
+        const Node &c = m_nodes[child];
+        if (const Json *next = step(value, c.token.key, c.token.index))
+            visit(child, *next, results);
     }
-    return json_vec;
 }
 
 /* * * * * * * * * * * * * * * * * * * *
@@ -785,4 +3884,295 @@ bool Json::has_shape(const shape & types, string & err) const {
     return true;
 }
 
+/* * * * * * * * * * * * * * * * * * * *
+ * Schema validation
+ */
+
+static const char * const schema_type_names[] = {
+    "null", "number", "boolean", "string", "array", "object", "integer"
+};
+
+JsonSchema::JsonSchema() : m_nodes(1) {
+    m_nodes[0].types = any_type;
+}
+
+JsonSchema JsonSchema::compile(const Json &description, string &err) {
+    JsonSchema schema;
+    schema.m_nodes.clear();
+    if (!schema.compile_node(description, 0, err)) {
+        schema.m_nodes.clear();
+        schema.m_valid = false;
+    }
+    return schema;
+}
+
+// Set value to the count in description, which must be a non-negative integer.
+static bool schema_count(const Json &description, const string &keyword, size_t &value,
+                         string &err) {
+    const double count = description.number_value();
+    if (!description.is_number() || count < 0 || count != std::floor(count)
+            || count >= static_cast<double>(std::numeric_limits<size_t>::max())) {
+        err = keyword + " must be a non-negative integer";
+        return false;
+    }
+    value = static_cast<size_t>(count);
+    return true;
+}
+
+bool JsonSchema::compile_node(const Json &description, int depth, string &err) {
+    if (depth > max_depth) {
+        err = "schema is too deeply nested";
+        return false;
+    }
+    if (!description.is_object()) {
+        err = "schema must be an object, got " + description.dump();
+        return false;
+    }
+
+    // Nodes are added as the schema is walked, so refer to this one by index.
+    const uint32_t node = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+    m_nodes[node].types = any_type;
+
+    const Json *required = nullptr;
+    for (const auto &member : description.object_items()) {
+        const string &keyword = member.first;
+        const Json &value = member.second;
+
+        if (keyword == "type") {
+            const Json::array names = value.is_array() ? value.array_items() : Json::array { value };
+            unsigned types = 0;
+            for (const Json &name : names) {
+                const auto begin = std::begin(schema_type_names);
+                const auto found = std::find(begin, std::end(schema_type_names), name.string_value());
+                if (!name.is_string() || found == std::end(schema_type_names)) {
+                    err = "unknown type in schema: " + name.dump();
+                    return false;
+                }
+                types |= 1u << (found - begin);
+            }
+            m_nodes[node].types = types;
+        } else if (keyword == "properties") {
+            if (!value.is_object()) {
+                err = "properties must be an object";
+                return false;
+            }
+            for (const auto &property : value.object_items()) {
+                const uint32_t child = static_cast<uint32_t>(m_nodes.size());
+                if (!compile_node(property.second, depth + 1, err))
+                    return false;
+                // Members come out sorted, so the properties stay sorted too.
+                m_nodes[node].properties.push_back({ property.first, child, false });
+            }
+        } else if (keyword == "required") {
+            if (!value.is_array()) {
+                err = "required must be an array";
+                return false;
+            }
+            required = &value;
+        } else if (keyword == "additionalProperties") {
+            if (!value.is_bool()) {
+                err = "additionalProperties must be a boolean";
+                return false;
+            }
+            m_nodes[node].additional_properties = value.bool_value();
+        } else if (keyword == "items") {
+            const uint32_t child = static_cast<uint32_t>(m_nodes.size());
+            if (!compile_node(value, depth + 1, err))
+                return false;
+            m_nodes[node].items = child;
+            m_nodes[node].has_items = true;
+        } else if (keyword == "minItems") {
+            if (!schema_count(value, keyword, m_nodes[node].min_items, err))
+                return false;
+        } else if (keyword == "maxItems") {
+            if (!schema_count(value, keyword, m_nodes[node].max_items, err))
+                return false;
+        } else if (keyword == "minimum" || keyword == "maximum") {
+            if (!value.is_number()) {
+                err = keyword + " must be a number";
+                return false;
+            }
+            (keyword == "minimum" ? m_nodes[node].minimum : m_nodes[node].maximum) = value.number_value();
+        } else if (keyword == "$schema" || keyword == "title" || keyword == "description") {
+            // Annotations; nothing to check.
+        } else {
+            err = "unsupported schema keyword: " + keyword;
+            return false;
+        }
+    }
+
+    if (required) {
+        for (const Json &name : required->array_items()) {
+            if (!name.is_string()) {
+                err = "required must list strings, got " + name.dump();
+                return false;
+            }
+            vector<Property> &properties = m_nodes[node].properties;
+            auto iter = std::lower_bound(properties.begin(), properties.end(), name.string_value(),
+                                         [](const Property &property, const string &key) {
+                                             return property.key < key;
+                                         });
+            if (iter != properties.end() && iter->key == name.string_value()) {
+                iter->required = true;
+            } else {
+                // Required but otherwise unconstrained. Adding its node may move m_nodes,
+                // and properties with it, so that comes last.
+                const uint32_t child = static_cast<uint32_t>(m_nodes.size());
+                properties.insert(iter, { name.string_value(), child, true });
+                m_nodes.emplace_back();
+                m_nodes.back().types = any_type;
+            }
+        }
+    }
+    return true;
+}
+
+// Describe a set of schema types, e.g. "string or null".
+static string schema_types_name(unsigned types) {
+    string name;
+    for (unsigned type = 0; type < 7; type++) {
+        if (!(types & (1u << type)))
+            continue;
+        if (!name.empty())
+            name += " or ";
+        name += schema_type_names[type];
+    }
+    return name;
+}
+
+// Prepend key to the JSON pointer in where, escaping it as RFC 6901 requires.
+static void schema_prepend(string &where, const string &key) {
+    string token = "/";
+    for (char ch : key) {
+        if (ch == '~')
+            token += "~0";
+        else if (ch == '/')
+            token += "~1";
+        else
+            token += ch;
+    }
+    where.insert(0, token);
+}
+
+bool JsonSchema::validate(const Json &value, string &err) const {
+    if (!m_valid) {
+        err = "invalid schema";
+        return false;
+    }
+    string where;
+    if (validate_node(0, value, where, err))
+        return true;
+    if (!where.empty())
+        err = where + ": " + err;
+    return false;
+}
+
+bool JsonSchema::validate_node(uint32_t node, const Json &value, string &where,
+                               string &err) const {
+    const Node &n = m_nodes[node];
+    const Json::Type type = value.type();
+
+    if (!(n.types & (1u << type))) {
+        const bool integer = (type == Json::NUMBER) && (n.types & integer_bit)
+                             && std::isfinite(value.number_value())
+                             && std::floor(value.number_value()) == value.number_value();
+        if (!integer) {
+            err = "expected " + schema_types_name(n.types) + ", got "
+                + ((type == Json::NUMBER && (n.types & integer_bit)) ? value.dump()
+                                                                      : schema_type_names[type]);
+            return false;
+        }
+    }
+
+    switch (type) {
+    case Json::NUMBER: {
+        const double number = value.number_value();
+        if (number < n.minimum) {
+            err = "expected a number >= " + Json(n.minimum).dump() + ", got " + value.dump();
+            return false;
+        }
+        if (number > n.maximum) {
+            err = "expected a number <= " + Json(n.maximum).dump() + ", got " + value.dump();
+            return false;
+        }
+        return true;
+    }
+
+    case Json::ARRAY: {
+        const Json::array &items = value.array_items();
+        if (items.size() < n.min_items || items.size() > n.max_items) {
+            err = "expected between " + std::to_string(n.min_items) + " and "
+                + (n.max_items == SIZE_MAX ? string("any number of")
+                                           : std::to_string(n.max_items))
+                + " items, got " + std::to_string(items.size());
+            return false;
+        }
+        if (n.has_items) {
+            for (size_t i = 0; i < items.size(); i++) {
+                if (!validate_node(n.items, items[i], where, err)) {
+                    schema_prepend(where, std::to_string(i));
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    case Json::OBJECT: {
+        const Json::object &members = value.object_items();
+        if (n.additional_properties && n.properties.size() * 4 < members.size()) {
+            // A few properties of a large object: look each one up.
+            for (const Property &property : n.properties) {
+                auto iter = members.find(property.key);
+                if (iter == members.end()) {
+                    if (!property.required)
+                        continue;
+                    err = "missing required member \"" + property.key + "\"";
+                    return false;
+                }
+                if (!validate_node(property.node, iter->second, where, err)) {
+                    schema_prepend(where, property.key);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Otherwise walk the members alongside the properties, which are in the same order.
+        auto property = n.properties.begin();
+        const auto end = n.properties.end();
+        for (const auto &member : members) {
+            int order = 1;
+            for (; property != end && (order = property->key.compare(member.first)) < 0; ++property) {
+                if (property->required) {
+                    err = "missing required member \"" + property->key + "\"";
+                    return false;
+                }
+            }
+            if (property != end && order == 0) {
+                if (!validate_node(property->node, member.second, where, err)) {
+                    schema_prepend(where, member.first);
+                    return false;
+                }
+                ++property;
+            } else if (!n.additional_properties) {
+                err = "unexpected member \"" + string(member.first) + "\"";
+                return false;
+            }
+        }
+        for (; property != end; ++property) {
+            if (property->required) {
+                err = "missing required member \"" + property->key + "\"";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    default:
+        return true;
+    }
+}
+
 } // namespace json11
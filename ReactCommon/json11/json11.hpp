@@ -4,14 +4,17 @@
  *
  * The core object provided by the library is json11::Json. A Json object represents any JSON
  * value: null, bool, number (int or double), string (std::string), array (std::vector), or
- * object (std::map).
+ * object (std::map, or JsonFlatObject if JSON11_FLAT_OBJECT is defined).
  *
  * Json objects act like values: they can be assigned, copied, moved, compared for equality or
  * order, etc. There are also helper methods Json::dump, to serialize a Json to a string, and
  * Json::parse (static) to parse a std::string as a Json object.
  *
- * Internally, the various types of Json object are represented by the JsonValue class
- * hierarchy.
+ * Internally, null, booleans, numbers and short strings are stored inline in the Json object
+ * itself, so building them never allocates. Arrays, objects and longer strings are held by
+ * reference to a node of the JsonValue class hierarchy, which copies of the Json share. Nodes
+ * are reference-counted with atomic operations, unless JSON11_LOCAL_REFCOUNT is defined (see
+ * Json::share).
  *
  * A note on numbers - JSON specifies the syntax of number formatting but not its semantics,
  * so some JSON implementations distinguish between integers and floating-point numbers, while
@@ -50,6 +53,12 @@
 
 #pragma once
 
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
@@ -75,6 +84,15 @@ enum JsonParse {
 };
 
 class JsonValue;
+class JsonArena;
+class JsonArenaPool;
+class JsonHandler;
+class DomBuilder;
+class JsonFlatObject;
+class JsonKeyTable;
+class JsonKeyAtoms;
+class JsonValueTable;
+class JsonWriter;
 
 class Json final {
 public:
@@ -85,7 +103,11 @@ public:
 
     // Array and object typedefs
     typedef std::vector<Json> array;
+#ifdef JSON11_FLAT_OBJECT
+    typedef JsonFlatObject object;
+#else
     typedef std::map<std::string, Json> object;
+#endif
 
     // Constructors for the various types of JSON value.
     Json() noexcept;                // NUL
@@ -122,6 +144,12 @@ public:
     // Json(bool(some_pointer)) if that behavior is desired.
     Json(void *) = delete;
 
+    Json(const Json &other);
+    Json(Json &&other) noexcept;
+    Json & operator=(const Json &other);
+    Json & operator=(Json &&other) noexcept;
+    ~Json();
+
     // Accessors
     Type type() const;
 
@@ -142,11 +170,39 @@ public:
     bool bool_value() const;
     // Return the enclosed string if this is a string, "" otherwise.
     const std::string &string_value() const;
+    // Return the enclosed string's bytes and length if this is a string, "" otherwise. Unlike
+    // string_value(), these never copy a string borrowed from the input of parse_borrowed().
+    const char *string_data() const;
+    size_t string_size() const;
     // Return the enclosed std::vector if this is an array, or an empty vector otherwise.
     const array &array_items() const;
-    // Return the enclosed std::map if this is an object, or an empty map otherwise.
+    // Return the enclosed object if this is an object, or an empty one otherwise.
     const object &object_items() const;
 
+    // Return the enclosed array or object, or an empty one if this is of another type, and
+    // leave this Json null. The contents are moved out if no other Json shares them, and
+    // copied otherwise.
+    array take_array();
+    object take_object();
+
+    // Copies of a Json share its nodes and count their owners. If json11 and everything
+    // including it are built with JSON11_LOCAL_REFCOUNT defined, new nodes are local: their
+    // counts are updated without atomic operations, so a value and all of its copies must stay
+    // on one thread (or be handed over to another one all together). share() switches every
+    // local node of this value to atomic counting, after which it may be copied and destroyed
+    // on any thread. It copies nothing and stops at nodes that are already shared. Without
+    // JSON11_LOCAL_REFCOUNT every node is shared from the start, and share() does nothing.
+    const Json & share() const;
+
+    // Return a hash of this value's contents; equal values have equal hashes. It is computed
+    // once for each array, object and long string and then kept in its node, which also lets
+    // operator== tell most unequal arrays and objects apart without comparing them.
+    size_t hash() const;
+
+    // Return a value equal to this one in which structurally equal arrays, objects and long
+    // strings share a single node (see JsonValueTable).
+    Json dedupe() const;
+
     // Return a reference to arr[i] if this is an array, Json() otherwise.
     const Json & operator[](size_t i) const;
     // Return a reference to obj[key] if this is an object, Json() otherwise.
@@ -159,21 +215,83 @@ public:
         dump(out);
         return out;
     }
+    // Serialize to writer (see JsonWriter).
+    void dump(JsonWriter &writer) const;
+    // Return the number of bytes dump() would produce, without keeping them.
+    size_t dump_size() const;
+
+    // Encode as CBOR (RFC 8949), appending to out. With share_strings, a string that occurs
+    // more than once, such as a key repeated across an array of objects, is written in full
+    // only the first time and then referred to by index (the stringref extension).
+    void to_binary(std::string &out, bool share_strings = false) const;
+    void to_binary(JsonWriter &writer, bool share_strings = false) const;
+
+    // Decode one CBOR value. If decoding fails, return Json() and assign an error message to
+    // err. Integers that don't fit in an int, like all other numbers, decode as doubles.
+    static Json from_binary(const char * data, size_t size, std::string & err);
+    static Json from_binary(const std::string & in, std::string & err) {
+        return from_binary(in.data(), in.size(), err);
+    }
 
     // Parse. If parse fails, return Json() and assign an error message to err.
     static Json parse(const std::string & in,
                       std::string & err,
                       JsonParse strategy = JsonParse::STANDARD);
+    // Parse, taking the storage for every node of the result from arena.
+    static Json parse(const std::string & in,
+                      std::string & err,
+                      JsonArena & arena,
+                      JsonParse strategy = JsonParse::STANDARD);
+    // Parse, making the keys of the result's objects atoms of keys where they fit (see
+    // JsonKeyTable).
+    static Json parse(const std::string & in,
+                      std::string & err,
+                      JsonKeyTable & keys,
+                      JsonParse strategy = JsonParse::STANDARD);
     static Json parse(const char * in,
                       std::string & err,
                       JsonParse strategy = JsonParse::STANDARD) {
         if (in) {
-            return parse(std::string(in), err, strategy);
+            return parse(in, strlen(in), err, strategy);
         } else {
             err = "null input";
             return nullptr;
         }
     }
+    // Parse the length bytes at in, which need not be NUL-terminated, without copying them.
+    static Json parse(const char * in,
+                      size_t length,
+                      std::string & err,
+                      JsonParse strategy = JsonParse::STANDARD);
+    // Like parse(in, length, ...), but strings that need no unescaping are not copied out of
+    // the input: the result points into it, so the caller must keep the buffer alive and
+    // unchanged for as long as the result or any value taken from it is in use.
+    static Json parse_borrowed(const char * in,
+                               size_t length,
+                               std::string & err,
+                               JsonParse strategy = JsonParse::STANDARD);
+    // Parse on demand: only the top-level value is built now. Arrays and objects below it are
+    // checked but not built, and each is parsed, one level at a time, the first time its
+    // contents are asked for, so the parts of a large document that are never looked at cost
+    // no more than a syntax check. The whole document is checked now, and err is set for
+    // exactly the inputs parse() rejects. The result keeps in alive until it and every value
+    // taken from it are gone.
+    static Json parse_lazy(std::string in,
+                           std::string & err,
+                           JsonParse strategy = JsonParse::STANDARD);
+    // Parse without building a Json, reporting each value to handler as it is read (see
+    // JsonHandler). Return false and assign an error message to err if parsing fails or the
+    // handler stops it.
+    static bool parse_events(const std::string & in,
+                             JsonHandler & handler,
+                             std::string & err,
+                             JsonParse strategy = JsonParse::STANDARD);
+    static bool parse_events(const char * in,
+                             size_t length,
+                             JsonHandler & handler,
+                             std::string & err,
+                             JsonParse strategy = JsonParse::STANDARD);
+
     // Parse multiple objects, concatenated or separated by whitespace
     static std::vector<Json> parse_multi(
         const std::string & in,
@@ -189,6 +307,26 @@ public:
         return parse_multi(in, parser_stop_pos, err, strategy);
     }
 
+    // Like parse_multi, but split the input at line breaks and parse the pieces on up to
+    // threads threads at once (by default, one per core). The values, error and stop position
+    // are the same as parse_multi's. A piece that turns out to start inside a value, as in
+    // pretty-printed input, is parsed again after the piece before it.
+    static std::vector<Json> parse_multi_parallel(
+        const std::string & in,
+        std::string::size_type & parser_stop_pos,
+        std::string & err,
+        JsonParse strategy = JsonParse::STANDARD,
+        unsigned threads = 0);
+
+    static inline std::vector<Json> parse_multi_parallel(
+        const std::string & in,
+        std::string & err,
+        JsonParse strategy = JsonParse::STANDARD,
+        unsigned threads = 0) {
+        std::string::size_type parser_stop_pos;
+        return parse_multi_parallel(in, parser_stop_pos, err, strategy, threads);
+    }
+
     bool operator== (const Json &rhs) const;
     bool operator<  (const Json &rhs) const;
     bool operator!= (const Json &rhs) const { return !(*this == rhs); }
@@ -200,33 +338,771 @@ public:
      *
      * Return true if this is a JSON object and, for each item in types, has a field of
      * the given type. If not, return false and set err to a descriptive message.
+     * JsonSchema checks nested values and is cheaper when the same shape is checked often.
      */
     typedef std::initializer_list<std::pair<std::string, Type>> shape;
     bool has_shape(const shape & types, std::string & err) const;
 
 private:
-    std::shared_ptr<JsonValue> m_ptr;
+    friend class JsonArena;
+    friend class DomBuilder;
+    friend class JsonValueTable;
+    // Takes over the reference that node was created with.
+    explicit Json(JsonValue *node) noexcept;
+    static Json borrowed(const char *data, size_t size);
+
+    void copy_from(const Json &other);
+    void move_from(Json &&other) noexcept;
+    void destroy() noexcept;
+
+    // Strings up to this length are stored inline. Every common standard library keeps a
+    // std::string of this size in its own small-string buffer, so they never allocate.
+    static const size_t max_inline_string = 15;
+
+    // How the value is held: inline (everything but REPR_NODE), or in a shared JsonValue.
+    enum Repr : unsigned char {
+        REPR_NUL, REPR_BOOL, REPR_INT, REPR_DOUBLE, REPR_STRING, REPR_NODE
+    };
+
+    Repr m_repr;
+    union {
+        bool m_bool;
+        int m_int;
+        double m_double;
+        std::string m_string;
+        JsonValue *m_ptr;
+    };
+};
+
+/* JsonKey
+ *
+ * The key of a JsonFlatObject member: an immutable string held by reference, so that copying
+ * a key never copies its bytes, and whose hash is computed once, when it is created. It
+ * converts to const std::string &, so code written against std::map keys keeps working.
+ *
+ * Keys obtained from a JsonKeyTable are atoms. The table keeps a single copy of each, which
+ * is never freed, so equal atoms are the same pointer and copying one touches no reference
+ * count. Any other key is reference-counted.
+ */
+class JsonKey final {
+public:
+    JsonKey() noexcept : m_rep(empty_rep()) {}
+    JsonKey(const char *data, size_t size);
+    JsonKey(const char *key) : JsonKey(key, strlen(key)) {}
+    JsonKey(const std::string &key) : JsonKey(key.data(), key.size()) {}
+    JsonKey(std::string &&key);
+
+    JsonKey(const JsonKey &other) noexcept : m_rep(other.m_rep) { retain(); }
+    JsonKey(JsonKey &&other) noexcept : m_rep(other.m_rep) { other.m_rep = empty_rep(); }
+    JsonKey &operator=(const JsonKey &other) noexcept {
+        JsonKey(other).swap(*this);
+        return *this;
+    }
+    JsonKey &operator=(JsonKey &&other) noexcept {
+        swap(other);
+        return *this;
+    }
+    ~JsonKey() { release(); }
+
+    void swap(JsonKey &other) noexcept { std::swap(m_rep, other.m_rep); }
+
+    const std::string &str() const { return m_rep->str; }
+    operator const std::string &() const { return m_rep->str; }
+    const char *data() const { return m_rep->str.data(); }
+    const char *c_str() const { return m_rep->str.c_str(); }
+    size_t size() const { return m_rep->str.size(); }
+    bool empty() const { return m_rep->str.empty(); }
+    size_t hash() const { return m_rep->hash; }
+    bool is_atom() const { return m_rep->atom; }
+
+    // The hash a key with these bytes has.
+    static size_t hash_bytes(const char *data, size_t size);
+
+    // Compare bytes, like std::string::compare.
+    int compare(const char *data, size_t size) const;
+    int compare(const std::string &other) const { return compare(other.data(), other.size()); }
+    int compare(const JsonKey &other) const {
+        return (m_rep == other.m_rep) ? 0 : compare(other.data(), other.size());
+    }
+
+    // Lets a key be used as a Json string.
+    Json to_json() const { return Json(m_rep->str); }
+
+    friend bool operator==(const JsonKey &a, const JsonKey &b) {
+        return a.m_rep == b.m_rep || (a.hash() == b.hash() && a.str() == b.str());
+    }
+    friend bool operator==(const JsonKey &a, const std::string &b) { return a.str() == b; }
+    friend bool operator==(const std::string &a, const JsonKey &b) { return a == b.str(); }
+    friend bool operator==(const JsonKey &a, const char *b) { return a.str() == b; }
+    friend bool operator==(const char *a, const JsonKey &b) { return a == b.str(); }
+    friend bool operator!=(const JsonKey &a, const JsonKey &b) { return !(a == b); }
+    friend bool operator!=(const JsonKey &a, const std::string &b) { return !(a == b); }
+    friend bool operator!=(const std::string &a, const JsonKey &b) { return !(a == b); }
+    friend bool operator!=(const JsonKey &a, const char *b) { return !(a == b); }
+    friend bool operator!=(const char *a, const JsonKey &b) { return !(a == b); }
+    friend bool operator<(const JsonKey &a, const JsonKey &b) { return a.compare(b) < 0; }
+    friend bool operator<(const JsonKey &a, const std::string &b) { return a.compare(b) < 0; }
+    friend bool operator<(const std::string &a, const JsonKey &b) { return b.compare(a) > 0; }
+
+private:
+    friend class JsonKeyAtoms;
+
+    struct Rep {
+        Rep(std::string str, size_t hash, bool atom)
+            : str(std::move(str)), hash(hash), refs(1), atom(atom) {}
+        const std::string str;
+        const size_t hash;
+        // Unused for atoms.
+        std::atomic<size_t> refs;
+        const bool atom;
+    };
+
+    friend class DomBuilder;
+    explicit JsonKey(Rep *rep) noexcept : m_rep(rep) {}
+    JsonKey(const char *data, size_t size, size_t hash)
+        : m_rep(new Rep(std::string(data, size), hash, false)) {}
+
+    static Rep *empty_rep() noexcept;
+    void retain() noexcept {
+        if (!m_rep->atom)
+            m_rep->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void release() noexcept {
+        if (!m_rep->atom && m_rep->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete m_rep;
+    }
+
+    Rep *m_rep;
+};
+
+/* JsonKeyTable
+ *
+ * A set of atoms (see JsonKey) that any number of parses, on any number of threads, can
+ * share. Parsing with a table turns every object key that fits in it into an atom, so
+ * documents that repeat the same keys hold one copy of each, and comparing two keys is a
+ * pointer comparison. Atoms are never freed, not even with the table, so a table stops
+ * adding keys once it holds max_keys of them and never adds keys longer than max_key_size;
+ * other keys are stored as usual.
+ *
+ * Only JsonFlatObject stores keys as JsonKey, so a table has no effect on parsing unless
+ * JSON11_FLAT_OBJECT is defined.
+ */
+class JsonKeyTable final {
+public:
+    explicit JsonKeyTable(size_t max_keys = 4096, size_t max_key_size = 64);
+    JsonKeyTable(const JsonKeyTable &) = delete;
+    JsonKeyTable & operator=(const JsonKeyTable &) = delete;
+    ~JsonKeyTable();
+
+    // Return the atom for key, adding it if it fits; otherwise return an ordinary key.
+    JsonKey intern(const char *data, size_t size);
+    JsonKey intern(const std::string &key) { return intern(key.data(), key.size()); }
+
+    // Number of atoms held.
+    size_t size() const;
+
+private:
+    friend class DomBuilder;
+    JsonKey intern(const char *data, size_t size, size_t hash);
+
+    std::unique_ptr<JsonKeyAtoms> m_atoms;
+};
+
+/* JsonFlatObject
+ *
+ * An alternative representation for Json::object, used in place of std::map when json11 and
+ * everything including it are built with JSON11_FLAT_OBJECT defined. Members are kept sorted
+ * by key in a single vector, so iteration order, comparisons and duplicate-key handling are
+ * the same as with std::map, but a small object is one allocation and is searched without
+ * chasing pointers. Once an object has more than index_threshold members it also keeps an
+ * open-addressing hash index into that vector, so lookups in large objects stay fast.
+ *
+ * Keys are stored as JsonKey, which is a single pointer and can be shared between objects.
+ * Inserting or erasing a member moves the ones after it and invalidates iterators.
+ */
+class JsonFlatObject final {
+public:
+    typedef JsonKey key_type;
+    typedef Json mapped_type;
+    typedef std::pair<JsonKey, Json> value_type;
+    typedef std::vector<value_type>::iterator iterator;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+    typedef size_t size_type;
+
+    static const size_t index_threshold = 16;
+
+    JsonFlatObject() noexcept {}
+    JsonFlatObject(std::initializer_list<value_type> members)
+        : JsonFlatObject(members.begin(), members.end()) {}
+    // As with std::map, where a key repeats the first occurrence is kept.
+    template <class It>
+    JsonFlatObject(It first, It last) {
+        for (; first != last; ++first)
+            m_members.emplace_back(first->first, first->second);
+        normalize(false);
+    }
+
+    iterator begin() noexcept { return m_members.begin(); }
+    iterator end() noexcept { return m_members.end(); }
+    const_iterator begin() const noexcept { return m_members.begin(); }
+    const_iterator end() const noexcept { return m_members.end(); }
+    const_iterator cbegin() const noexcept { return m_members.begin(); }
+    const_iterator cend() const noexcept { return m_members.end(); }
+
+    bool empty() const noexcept { return m_members.empty(); }
+    size_t size() const noexcept { return m_members.size(); }
+    void reserve(size_t count) { m_members.reserve(count); }
+    void clear() noexcept;
+
+    iterator find(const std::string &key) { return begin() + position(key); }
+    const_iterator find(const std::string &key) const { return begin() + position(key); }
+    size_t count(const std::string &key) const { return position(key) != size() ? 1 : 0; }
+    iterator lower_bound(const std::string &key);
+    const_iterator lower_bound(const std::string &key) const;
+
+    // Throw std::out_of_range if there is no member with this key.
+    Json &at(const std::string &key);
+    const Json &at(const std::string &key) const;
+
+    Json &operator[](const std::string &key);
+    Json &operator[](std::string &&key);
+
+    std::pair<iterator, bool> insert(const value_type &member) { return insert(value_type(member)); }
+    std::pair<iterator, bool> insert(value_type &&member);
+    template <class It>
+    void insert(It first, It last) {
+        for (; first != last; ++first)
+            insert(value_type(first->first, first->second));
+    }
+    template <class... Args>
+    std::pair<iterator, bool> emplace(Args &&... args) {
+        return insert(value_type(std::forward<Args>(args)...));
+    }
+
+    size_t erase(const std::string &key);
+    iterator erase(const_iterator pos);
+
+    // Replace the contents with members, given in any order. Where a key repeats, the last
+    // occurrence wins, as if each member had been assigned in turn with operator[].
+    void assign(std::vector<value_type> &&members);
+
+    void swap(JsonFlatObject &other) noexcept {
+        m_members.swap(other.m_members);
+        m_index.swap(other.m_index);
+    }
+
+    bool operator== (const JsonFlatObject &rhs) const { return m_members == rhs.m_members; }
+    bool operator<  (const JsonFlatObject &rhs) const { return m_members < rhs.m_members; }
+    bool operator!= (const JsonFlatObject &rhs) const { return !(*this == rhs); }
+
+private:
+    // Index of the member with this key, or size() if there is none.
+    size_t position(const std::string &key) const;
+    iterator insert_at(size_t pos, value_type &&member);
+    void normalize(bool keep_last);
+    void rebuild_index();
+    void index_insert(size_t pos);
+
+    std::vector<value_type> m_members;
+    // Hash slots holding a member's position plus one, or zero when free; empty while the
+    // object is at or below index_threshold members.
+    std::vector<uint32_t> m_index;
+};
+
+/* JsonBuilder
+ *
+ * Builds up an array or object in place and hands it over as a Json without copying it.
+ * Starting from an existing Json takes over its contents, which are only copied if another
+ * Json still shares them (see Json::take_array).
+ */
+class JsonBuilder final {
+public:
+    // Start an empty object, or an empty array if type is Json::ARRAY.
+    explicit JsonBuilder(Json::Type type = Json::OBJECT);
+    // Start from the contents of value if it is an array or object, or an empty object if not.
+    explicit JsonBuilder(Json &&value);
+
+    bool is_array() const { return m_type == Json::ARRAY; }
+    size_t size() const { return is_array() ? m_array.size() : m_object.size(); }
+
+    // Add or replace a member. Does nothing when building an array.
+    JsonBuilder &set(const std::string &key, Json value);
+    JsonBuilder &set(std::string &&key, Json value);
+    // Remove a member. Does nothing when building an array.
+    JsonBuilder &erase(const std::string &key);
+    // Append an element. Does nothing when building an object.
+    JsonBuilder &push_back(Json value);
+
+    // The contents built so far, for changes the methods above don't cover.
+    Json::array &array_items() { return m_array; }
+    Json::object &object_items() { return m_object; }
+
+    // Return the result, and start over with an empty container of the same type.
+    Json finish();
+
+private:
+    Json::Type m_type;
+    Json::array m_array;
+    Json::object m_object;
+};
+
+/* JsonPath
+ *
+ * A JSON Pointer (RFC 6901) such as "/args/0/name", parsed once so that it can be looked up
+ * in any number of values. Lookups allocate nothing: keys are kept as strings, and reference
+ * tokens that are valid array indices are also kept as numbers.
+ */
+class JsonPath final {
+public:
+    // An empty pointer, which refers to the whole value.
+    JsonPath() {}
+    // Parse pointer. If it is malformed, return a path that refers to nothing and assign an
+    // error message to err.
+    static JsonPath parse(const std::string &pointer, std::string &err);
+
+    bool valid() const { return m_valid; }
+    // Number of reference tokens.
+    size_t size() const { return m_tokens.size(); }
+
+    // Return the value this path refers to within root, or nullptr if there is none.
+    const Json *find(const Json &root) const;
+    // Return the value this path refers to within root, or Json() if there is none.
+    const Json &get(const Json &root) const;
+
+private:
+    friend class JsonPathSet;
+
+    struct Token {
+        std::string key;
+        // The token as an array index, or npos if it isn't one.
+        size_t index;
+    };
+
+    static bool parse_token(const char *begin, const char *end, Token &token, std::string &err);
+
+    std::vector<Token> m_tokens;
+    bool m_valid = true;
+};
+
+/* JsonPathSet
+ *
+ * A set of JSON Pointers looked up together. The paths are merged into a trie, so that one
+ * walk over a value finds all of them and a shared prefix is only followed once.
+ */
+class JsonPathSet final {
+public:
+    JsonPathSet();
+
+    // Add a path and return its position in the results of find(). If pointer is malformed,
+    // return -1 and assign an error message to err.
+    int add(const std::string &pointer, std::string &err);
+    size_t size() const { return m_count; }
+
+    // Set results[i] to the value the i-th path added refers to within root, or to nullptr if
+    // there is none. Reusing results across calls avoids allocating.
+    void find(const Json &root, std::vector<const Json *> &results) const;
+
+private:
+    struct Node {
+        JsonPath::Token token;
+        // Indices of the child nodes, sorted by token key.
+        std::vector<uint32_t> children;
+        // Positions of the paths that end at this node.
+        std::vector<uint32_t> paths;
+    };
+
+    void visit(uint32_t node, const Json &value, const Json **results) const;
+
+    std::vector<Node> m_nodes;
+    size_t m_count = 0;
+};
+
+/* JsonSchema
+ *
+ * A validator compiled from a subset of JSON Schema, for example
+ *
+ *     { "type": "object",
+ *       "properties": { "id": { "type": "integer", "minimum": 0 },
+ *                       "tags": { "type": "array", "items": { "type": "string" } } },
+ *       "required": [ "id" ] }
+ *
+ * Supported keywords are type (a name or an array of names), properties, required,
+ * additionalProperties (a boolean), items (a single schema), minItems, maxItems, minimum and
+ * maximum; compiling rejects any other. validate() checks a value in one pass and allocates
+ * nothing unless the value is rejected.
+ */
+class JsonSchema final {
+public:
+    // A schema that accepts any value.
+    JsonSchema();
+    // Compile description. If it is not a supported schema, return a schema that rejects every
+    // value and assign an error message to err.
+    static JsonSchema compile(const Json &description, std::string &err);
+
+    bool valid() const { return m_valid; }
+
+    // Return true if value conforms to this schema. If not, return false and assign a message
+    // naming the offending location as a JSON pointer to err.
+    bool validate(const Json &value, std::string &err) const;
+
+private:
+    struct Property {
+        std::string key;
+        uint32_t node;
+        bool required;
+    };
+
+    struct Node {
+        // Bit (1 << Json::Type) for each accepted type, plus integer_bit.
+        unsigned types;
+        bool additional_properties = true;
+        // Sorted by key.
+        std::vector<Property> properties;
+        uint32_t items = 0;
+        bool has_items = false;
+        size_t min_items = 0;
+        size_t max_items = SIZE_MAX;
+        double minimum = -HUGE_VAL;
+        double maximum = HUGE_VAL;
+    };
+
+    static const unsigned any_type = 0x3f;
+    static const unsigned integer_bit = 0x40;
+
+    bool compile_node(const Json &description, int depth, std::string &err);
+    bool validate_node(uint32_t node, const Json &value, std::string &where,
+                       std::string &err) const;
+
+    std::vector<Node> m_nodes;
+    bool m_valid = true;
+};
+
+/* JsonValueTable
+ *
+ * Hash-consing for Json values. intern() returns a value equal to its argument in which every
+ * array, object and long string is the same node as any structurally equal one interned
+ * before, so repeated subtrees, such as a style object used by many views, are stored once
+ * however many values contain them. The table keeps its nodes alive until it is destroyed;
+ * values it returned stay valid after that. Strings borrowed from the input of
+ * Json::parse_borrowed() are copied. A table must only be used by one thread at a time.
+ */
+class JsonValueTable final {
+public:
+    JsonValueTable() {}
+    JsonValueTable(const JsonValueTable &) = delete;
+    JsonValueTable & operator=(const JsonValueTable &) = delete;
+    ~JsonValueTable();
+
+    Json intern(const Json &value);
+
+    // Number of distinct nodes held.
+    size_t size() const { return m_count; }
+
+private:
+    // Whether a and b are the same inline value or share a node.
+    static bool same(const Json &a, const Json &b);
+    Json canonical(Json &&candidate);
+    void grow();
+
+    // Open-addressing hash set of the nodes, each holding a reference.
+    std::vector<JsonValue *> m_slots;
+    size_t m_count = 0;
+};
+
+/* JsonArena
+ *
+ * A bump allocator for Json nodes. Values parsed or built through an arena take their node
+ * storage from it instead of doing one heap allocation per value, and that storage is
+ * released all at once, after the arena and every value allocated from it are gone. This
+ * suits short-lived trees such as the params of a single native call.
+ *
+ * Only the nodes themselves come from the arena; the buffers owned by strings, arrays and
+ * objects still use the standard allocator. An arena must only be allocated from by one
+ * thread at a time, but the values it produces can be read, copied and destroyed anywhere.
+ */
+class JsonArena final {
+public:
+    explicit JsonArena(size_t block_size = 16 * 1024);
+
+    // Build values whose nodes live in this arena.
+    Json make(double value);
+    Json make(int value);
+    Json make(bool value);
+    Json make(const std::string &value);
+    Json make(std::string &&value);
+    Json make(const char * value);
+    Json make(const Json::array &values);
+    Json make(Json::array &&values);
+    Json make(const Json::object &values);
+    Json make(Json::object &&values);
+
+    // Bytes handed out to nodes so far, and bytes reserved from the system for them.
+    size_t bytes_used() const;
+    size_t bytes_reserved() const;
+
+private:
+    std::shared_ptr<JsonArenaPool> m_pool;
+};
+
+/* JsonHandler
+ *
+ * Receives the events of Json::parse_events, in document order: one call per scalar, and
+ * start/end calls around the contents of each array and object, where every member is a key()
+ * followed by its value. Strings are passed as (data, size) and are only valid for the duration
+ * of the call. Each callback returns true to continue, or false to stop the parse.
+ */
+class JsonHandler {
+public:
+    virtual ~JsonHandler() {}
+
+    virtual bool on_null() = 0;
+    virtual bool on_bool(bool value) = 0;
+    virtual bool on_number(double value) = 0;
+    // Numbers that fit in an int are reported here; by default they are treated like any other.
+    virtual bool on_int(int value) { return on_number(value); }
+    virtual bool on_string(const char *data, size_t size) = 0;
+
+    virtual bool start_object() = 0;
+    virtual bool key(const char *data, size_t size) = 0;
+    virtual bool end_object() = 0;
+
+    virtual bool start_array() = 0;
+    virtual bool end_array() = 0;
+};
+
+/* JsonStreamParser
+ *
+ * A push parser for a sequence of values, concatenated or separated by whitespace as for
+ * Json::parse_multi, whose text arrives in pieces. Each value is passed to the callback as
+ * soon as the chunk that closes it has been fed, and only the text of a value still in
+ * progress is kept between calls, so memory stays around one chunk plus one partial value.
+ */
+class JsonStreamParser final {
+public:
+    typedef std::function<void(Json &&value)> Callback;
+
+    explicit JsonStreamParser(Callback callback, JsonParse strategy = JsonParse::STANDARD);
+
+    // Consume the next length bytes of input. Return false, and set error(), if the input is
+    // malformed; the rest of the stream is then ignored until finish().
+    bool feed(const char *data, size_t length);
+    bool feed(const std::string &data) { return feed(data.data(), data.size()); }
+    // Signal the end of the input, completing a trailing number or literal. Return false, and
+    // set error(), if a value was left incomplete. The parser is then ready for a new stream.
+    bool finish();
+
+    const std::string &error() const { return m_error; }
+    // Bytes of input held for the value in progress.
+    size_t buffered() const { return m_buffer.size(); }
+
+private:
+    size_t scan(const char *data, size_t length, bool stop_at_first);
+    bool parse_values(const char *data, size_t length, size_t available);
+
+    // Where the scan is in the structure of the input: between values, or inside a container,
+    // a string or a number or literal.
+    enum State : unsigned char { BETWEEN, CONTAINER, STRING, SCALAR };
+    enum Comment : unsigned char {
+        NO_COMMENT, COMMENT_SLASH, LINE_COMMENT, BLOCK_COMMENT, BLOCK_COMMENT_STAR
+    };
+
+    Callback m_callback;
+    JsonParse m_strategy;
+    std::string m_buffer;
+    std::string m_error;
+    bool m_failed = false;
+    State m_state = BETWEEN;
+    Comment m_comment = NO_COMMENT;
+    bool m_escape = false;
+    size_t m_depth = 0;
+};
+
+/* JsonWriter
+ *
+ * A destination for Json::dump(JsonWriter &). The serializer copies its output into the
+ * window [m_pos, m_end) provided by the writer, and only calls overflow() when that is full,
+ * so writing stays a bounds check and a memcpy. Output is only guaranteed to have reached the
+ * destination after flush() or once the writer is destroyed.
+ *
+ * If the destination fails or runs out of room, the rest of the output is dropped and
+ * failed() returns true.
+ */
+class JsonWriter {
+public:
+    virtual ~JsonWriter() {}
+
+    void write(const char *data, size_t size) {
+        if (size <= static_cast<size_t>(m_end - m_pos)) {
+            memcpy(m_pos, data, size);
+            m_pos += size;
+        } else {
+            write_slow(data, size);
+        }
+    }
+    void write(char ch) {
+        if (m_pos != m_end)
+            *m_pos++ = ch;
+        else
+            write_slow(&ch, 1);
+    }
+
+    // Pass everything written so far on to the destination. Return false if any output
+    // has been lost.
+    bool flush();
+    bool failed() const { return m_failed; }
+
+protected:
+    // Called when the window has fewer than size bytes left. Take the bytes written to it,
+    // then point m_pos and m_end at a new window, ideally of at least size bytes. Return false
+    // if no more output can be accepted.
+    virtual bool overflow(size_t size) = 0;
+    // Called by flush(). Return false if the output could not be delivered.
+    virtual bool sync() { return true; }
+
+    char *m_pos = nullptr;
+    char *m_end = nullptr;
+
+private:
+    void write_slow(const char *data, size_t size);
+    bool m_failed = false;
+};
+
+// Appends to a std::string, through an internal buffer. Pass Json::dump_size() as size_hint
+// to have the string allocated exactly once.
+class JsonStringWriter final : public JsonWriter {
+public:
+    explicit JsonStringWriter(std::string &out, size_t size_hint = 0);
+    ~JsonStringWriter();
+
+private:
+    bool overflow(size_t size) override;
+    bool sync() override;
+
+    std::string &m_out;
+    char m_buffer[4096];
+};
+
+// Writes into a fixed caller-owned buffer; output beyond its end is dropped.
+class JsonBufferWriter final : public JsonWriter {
+public:
+    JsonBufferWriter(char *buffer, size_t size);
+
+    // Number of bytes written to the buffer so far.
+    size_t size() const { return m_pos - m_begin; }
+
+private:
+    bool overflow(size_t size) override;
+
+    char *m_begin;
+};
+
+// Writes through a stdio stream, or a file descriptor, via an internal buffer.
+class JsonFileWriter final : public JsonWriter {
+public:
+    explicit JsonFileWriter(FILE *file);
+    explicit JsonFileWriter(int fd);
+    ~JsonFileWriter();
+
+private:
+    bool overflow(size_t size) override;
+    bool sync() override;
+
+    FILE *m_file;
+    int m_fd;
+    char m_buffer[8192];
+};
+
+// Collects the output in a list of separately allocated chunks, so it never needs to be
+// copied to grow. Suits large output that is going to be handed on piecewise anyway.
+class JsonChunkWriter final : public JsonWriter {
+public:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    explicit JsonChunkWriter(size_t chunk_size = 64 * 1024);
+
+    // The output so far, in order. Only complete after flush().
+    const std::vector<Chunk> &chunks() const { return m_chunks; }
+    // Total number of bytes in chunks().
+    size_t size() const;
+    // The output concatenated into one string.
+    std::string str() const;
+
+private:
+    bool overflow(size_t size) override;
+    bool sync() override;
+
+    size_t m_chunk_size;
+    std::vector<Chunk> m_chunks;
 };
 
 // Internal class hierarchy - JsonValue objects are not exposed to users of this API.
 class JsonValue {
 protected:
     friend class Json;
-    friend class JsonInt;
-    friend class JsonDouble;
+
+    void retain() const noexcept {
+        if (m_shared)
+            m_refs.fetch_add(1, std::memory_order_relaxed);
+        else
+            m_refs.store(m_refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    void release() const noexcept {
+        size_t refs;
+        if (m_shared) {
+            refs = m_refs.fetch_sub(1, std::memory_order_acq_rel) - 1;
+        } else {
+            refs = m_refs.load(std::memory_order_relaxed) - 1;
+            m_refs.store(refs, std::memory_order_relaxed);
+        }
+        if (refs == 0)
+            const_cast<JsonValue *>(this)->destroy();
+    }
+    bool unique() const noexcept { return m_refs.load(std::memory_order_acquire) == 1; }
+
+    // Free this node once the last reference to it is gone.
+    virtual void destroy() noexcept { delete this; }
+    // Whether this is a string that points into a buffer it doesn't own.
+    virtual bool borrowed() const { return false; }
+
     virtual Json::Type type() const = 0;
-    virtual bool equals(const JsonValue * other) const = 0;
-    virtual bool less(const JsonValue * other) const = 0;
-    virtual void dump(std::string &out) const = 0;
+    virtual void dump(JsonWriter &out) const = 0;
     virtual double number_value() const;
     virtual int int_value() const;
     virtual bool bool_value() const;
     virtual const std::string &string_value() const;
+    virtual const char *string_data() const;
+    virtual size_t string_size() const;
     virtual const Json::array &array_items() const;
     virtual const Json &operator[](size_t i) const;
     virtual const Json::object &object_items() const;
     virtual const Json &operator[](const std::string &key) const;
+    // The contents of an array or object node, for Json::take_array() and take_object() to
+    // move out of when nothing else shares the node; nullptr for other types.
+    virtual Json::array *mutable_array();
+    virtual Json::object *mutable_object();
+
+    JsonValue() {}
+    // A node that counts its references atomically from the start, whatever
+    // JSON11_LOCAL_REFCOUNT says.
+    explicit JsonValue(bool shared) : m_shared(shared) {}
     virtual ~JsonValue() {}
+
+private:
+    friend class JsonValueTable;
+
+    // Starts at one, for the Json the node is created for.
+    mutable std::atomic<size_t> m_refs { 1 };
+    // Json::hash() of the node, or zero until it is first asked for.
+    mutable std::atomic<size_t> m_hash { 0 };
+    // Whether m_refs is updated atomically; see Json::share.
+#ifdef JSON11_LOCAL_REFCOUNT
+    mutable bool m_shared = false;
+#else
+    mutable bool m_shared = true;
+#endif
 };
 
 } // namespace json11
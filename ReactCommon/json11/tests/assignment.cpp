@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+
+#include <json11.hpp>
+
+using namespace json11;
+
+namespace {
+
+Json nested() {
+  return Json::object{
+    {"a", Json::array{Json("a long string exceeding fifteen bytes"), 1, 2}},
+    {"b", "short"},
+  };
+}
+
+}
+
+TEST(JsonAssignment, CopyAssignChildToParent) {
+  Json j = nested();
+  j = j["a"];
+  ASSERT_TRUE(j.is_array());
+  EXPECT_EQ(j[0].string_value(), "a long string exceeding fifteen bytes");
+  EXPECT_EQ(j[2].int_value(), 2);
+
+  j = j[0];
+  EXPECT_EQ(j.string_value(), "a long string exceeding fifteen bytes");
+}
+
+TEST(JsonAssignment, CopyAssignInlineChildToParent) {
+  Json j = nested();
+  j = j["b"];
+  EXPECT_EQ(j.string_value(), "short");
+}
+
+TEST(JsonAssignment, MoveAssignChildToParent) {
+  Json j = nested();
+  j = Json(j["a"]);
+  ASSERT_TRUE(j.is_array());
+  EXPECT_EQ(j.array_items().size(), 3u);
+  EXPECT_EQ(j[0].string_value(), "a long string exceeding fifteen bytes");
+}
+
+TEST(JsonAssignment, SelfAssign) {
+  Json j = nested();
+  const Json &same = j;
+  j = same;
+  EXPECT_EQ(j, nested());
+  j = std::move(j);
+  EXPECT_EQ(j, nested());
+}
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <random>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include <json11.hpp>
+
+using namespace json11;
+
+namespace {
+
+// parse_lazy() must fail exactly when parse() does, with the same message, and otherwise
+// give the same value.
+void expectSameAsParse(const std::string &text, JsonParse strategy = JsonParse::STANDARD) {
+  std::string err, lazyErr;
+  const Json parsed = Json::parse(text, err, strategy);
+  const Json lazy = Json::parse_lazy(text, lazyErr, strategy);
+  EXPECT_EQ(lazyErr, err) << text;
+  if (err.empty()) {
+    EXPECT_EQ(lazy, parsed) << text;
+    EXPECT_EQ(lazy.dump(), parsed.dump()) << text;
+  }
+}
+
+}
+
+TEST(JsonParseLazy, MatchesParse) {
+  expectSameAsParse("[1, {\"a\": [true, null, \"x\\\"]\"]}, [[[]]], {}]");
+  expectSameAsParse("{\"a\": {\"b\": {\"c\": [1.5e3, -0, \"\\u00e9\"]}}}");
+  expectSameAsParse("[ /* ] */ [1, // }\n 2]]", JsonParse::COMMENTS);
+}
+
+TEST(JsonParseLazy, MalformedNestedValues) {
+  std::string err;
+  const Json value = Json::parse_lazy("[1,{\"a\": tru}]", err);
+  EXPECT_FALSE(err.empty());
+  EXPECT_TRUE(value.is_null());
+
+  const char *malformed[] = {
+    "[1,{\"a\": tru}]", "[[1,,2]]", "[[1 2]]", "[{\"a\" 1}]", "[{\"a\":1,}]", "[{1:2}]",
+    "[[01]]", "[[1.]]", "[[-]]", "[[1e]]", "[[\"\\x\"]]", "[[\"\\u12\"]]", "[[\"a\nb\"]]",
+    "[[}]", "[{]}", "[[1]}", "{\"a\":[[]]]", "[[/* */1]]",
+  };
+  for (const char *text : malformed) {
+    expectSameAsParse(text);
+  }
+}
+
+TEST(JsonParseLazy, TruncatedEscapes) {
+  const char *truncated[] = {
+    "[[\"\\", "[[\"a\\", "{\"a\":[\"\\", "{\"a\":{\"\\", "[[\"\\\\\\", "[[\"\\u", "[[\"\\u12",
+    "[[\"x\\\"", "[{\"\\\"\":[\"\\",
+  };
+  for (const char *text : truncated) {
+    std::string err;
+    Json::parse_lazy(text, err);
+    EXPECT_FALSE(err.empty()) << text;
+    expectSameAsParse(text);
+  }
+
+  const std::string escapes = "{\"a\":[[\"\\\\\",\"\\\"]\",\"\\u0041\\n\"],{\"k\\\"\":[\"\\\\\"]}]}";
+  for (size_t size = 0; size <= escapes.size(); size++) {
+    expectSameAsParse(escapes.substr(0, size));
+  }
+}
+
+TEST(JsonParseLazy, TooDeep) {
+  const std::string deep = std::string(300, '[') + std::string(300, ']');
+  expectSameAsParse(deep);
+}
+
+TEST(JsonParseLazy, Mutations) {
+  const std::string seeds[] = {
+    "{\"a\":[[\"\\\\\",\"\\\"]\"],{\"k\\\"\":[\"\\u0041\"]}]}",
+    "[[[\"x\\ny\"],[1,2,{\"q\":\"\\\\\"}]],[-1.5e-3,true,false,null]]",
+    "{\"a\":{\"b\":[\"\\\"\\\\\"]}} // c\n",
+  };
+  const char alphabet[] = "[]{}\",:\\u0aZ /*\n-.e";
+  std::mt19937 rng(9);
+  for (int n = 0; n < 20000; n++) {
+    std::string text = seeds[rng() % 3];
+    for (int k = rng() % 4; k > 0; k--) {
+      text[rng() % text.size()] = alphabet[rng() % (sizeof(alphabet) - 1)];
+    }
+    text.resize(rng() % (text.size() + 1));
+    expectSameAsParse(text, n % 2 ? JsonParse::COMMENTS : JsonParse::STANDARD);
+  }
+}
@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2015-present, Facebook, Inc.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <json11.hpp>
+
+using namespace json11;
+
+namespace {
+
+// Parsing must give bit for bit what strtod() gives, on both sides of the fast path.
+void expectSameAsStrtod(const std::string &text) {
+  std::string err;
+  const Json parsed = Json::parse(text, err);
+  ASSERT_TRUE(err.empty()) << text << ": " << err;
+  ASSERT_TRUE(parsed.is_number()) << text;
+  const double expected = std::strtod(text.c_str(), nullptr);
+  const double actual = parsed.number_value();
+  uint64_t expectedBits, actualBits;
+  memcpy(&expectedBits, &expected, sizeof(expected));
+  memcpy(&actualBits, &actual, sizeof(actual));
+  EXPECT_EQ(actualBits, expectedBits) << text;
+}
+
+void expectSameAsStrtod(const std::vector<std::string> &texts) {
+  for (const std::string &text : texts) {
+    expectSameAsStrtod(text);
+    if (text[0] != '-') {
+      expectSameAsStrtod("-" + text);
+    }
+  }
+}
+
+}
+
+TEST(JsonNumbers, NearHalfway) {
+  expectSameAsStrtod({
+    "9007199254740992", "9007199254740993", "9007199254740994", "9007199254740995",
+    "9007199254740993.0", "900719925474099.3e1", "9007199254740992.5", "90071992547409925e-1",
+    "1.00000000000000011102230246251565404236316680908203125",
+    "1.00000000000000011102230246251565404236316680908203124",
+    "1.00000000000000011102230246251565404236316680908203126",
+    "0.1", "0.2", "0.3", "0.30000000000000004", "2.675", "1.005", "123456.789e3",
+    "8.98846567431158e307", "4503599627370496.5", "4503599627370497.5",
+  });
+}
+
+TEST(JsonNumbers, Subnormals) {
+  expectSameAsStrtod({
+    "5e-324", "4.9406564584124654e-324", "2.4703282292062327e-324", "2.4703282292062328e-324",
+    "1e-323", "2.2250738585072009e-308", "2.2250738585072011e-308", "2.2250738585072014e-308",
+    "4.4501477170144023e-308", "1e-310", "0.0000000000000000000000000001e-300",
+  });
+}
+
+TEST(JsonNumbers, LongMantissas) {
+  expectSameAsStrtod({
+    "1234567890123456789", "12345678901234567890", "9999999999999999999", "99999999999999999999",
+    "18446744073709551615", "18446744073709551616", "0.1234567890123456789",
+    "0.12345678901234567890", "1234567890.123456789", "1234567890123456789e22",
+    "12345678901234567890e-22", "9007199254740993e22", "0.00000000000000000001234567890123456789",
+    "1000000000000000000000000000000", "100000000000000000000e-20",
+  });
+}
+
+TEST(JsonNumbers, LargeExponents) {
+  expectSameAsStrtod({
+    "1e22", "1e23", "1e-22", "1e-23", "9007199254740991e22", "9007199254740992e22",
+    "9007199254740991e-22", "9007199254740993e-22", "1e308", "1.7976931348623157e308",
+    "1.7976931348623158e308", "1.7976931348623159e308", "1e309", "1e-400", "1e100000",
+    "1e-100000", "0e999999", "1e0000000000000000022", "1E+22", "1.5e+300", "0.0e-5",
+  });
+}
+
+// Every mantissa around the 2^53 limit, scaled by every power of ten around the 10^22 limit.
+TEST(JsonNumbers, FastPathBoundary) {
+  const char *mantissas[] = {
+    "1", "9", "4503599627370495", "4503599627370497", "9007199254740991", "9007199254740992",
+    "9007199254740993", "99999999999999999", "123456789012345678",
+  };
+  for (const char *mantissa : mantissas) {
+    for (int exponent = -30; exponent <= 30; exponent++) {
+      expectSameAsStrtod(std::string(mantissa) + "e" + std::to_string(exponent));
+      std::string withPoint(mantissa);
+      withPoint.insert(1, ".");
+      if (withPoint.size() > 2) {
+        expectSameAsStrtod(withPoint + "e" + std::to_string(exponent));
+      }
+    }
+  }
+}
+
+TEST(JsonNumbers, Random) {
+  std::mt19937_64 rng(7);
+  for (int n = 0; n < 200000; n++) {
+    const int digits = 1 + rng() % 20;
+    std::string text(rng() % 2 ? "-" : "");
+    text += static_cast<char>('1' + rng() % 9);
+    for (int d = 1; d < digits; d++) {
+      text += static_cast<char>('0' + rng() % 10);
+    }
+    if (digits > 1 && rng() % 2) {
+      text.insert(text.size() - rng() % (digits - 1) - 1, ".");
+    }
+    const int range = rng() % 4 == 0 ? 330 : 30;
+    text += "e" + std::to_string(static_cast<int>(rng() % (2 * range + 1)) - range);
+    expectSameAsStrtod(text);
+  }
+}